@@ -39,6 +39,28 @@
  */
 #define WACOM_PROP_SERIALIDS "Wacom Serial IDs"
 
+/* CARD32, 16 values, number of events posted with a latency (kernel
+   timestamp to xf86Post*Event) below 32us, 64us, 128us, ... 524ms;
+   the last value counts all events above that
+   read-only
+ */
+#define WACOM_PROP_LATENCY_HISTOGRAM "Wacom Latency Histogram"
+
+/* CARD32, 12 values, bytes read and frames parsed (each low then high
+   32 bits), events filtered, states suppressed, states reduced to
+   motion, arbitration losses, channel exhaustion, event queue overflows,
+   states posted (low then high 32 bits). Counters for the tablet are
+   shared by all its tools, see wcmGetStatistics.
+   read-only
+ */
+#define WACOM_PROP_STATISTICS "Wacom Statistics"
+
+/* 8 bit, 1 value, writing a non-zero value dumps the tablet's flight
+   recorder into a new file in the FlightRecorderDir, see
+   wacom-recorder.h for the file format
+ */
+#define WACOM_PROP_FLIGHT_RECORDER "Wacom Flight Recorder"
+
 /* CARD32, 1 value */
 #define WACOM_PROP_SERIAL_BIND "Wacom Serial ID binding"
 
@@ -72,9 +94,22 @@
 /* 32 bit, 1 value */
 #define WACOM_PROP_PRESSURE_THRESHOLD "Wacom Pressure Threshold"
 
-/* 32 bit, 2 values, suppress, sample */
+/* 32 bit, 11 values, suppress, sample, then the suppress thresholds for
+   x, y, touch x, touch y, pressure, tilt, rotation, wheels and throttle.
+   The thresholds are derived from suppress when it changes, the ones
+   written along with a new suppress value are ignored. Writing only
+   suppress and sample derives them as well. */
 #define WACOM_PROP_SAMPLE "Wacom Sample and Suppress"
 
+/* 8 bit, 1 value, the coordinate filter: 0 sliding average, 1 One-Euro,
+   2 Kalman. All of them smooth as much as the sample window in Wacom
+   Sample and Suppress asks for. */
+#define WACOM_PROP_FILTER_MODE "Wacom Filter Mode"
+
+/* 32 bit, 1 value, how many ms ahead of the reported position the pen
+   position is extrapolated, 0 disables the prediction */
+#define WACOM_PROP_PREDICT "Wacom Prediction"
+
 /* BOOL, 1 value */
 #define WACOM_PROP_TOUCH "Wacom Enable Touch"
 
@@ -106,6 +141,13 @@
  */
 #define WACOM_PROP_DEBUGLEVELS "Wacom Debug Levels"
 
+/* CARD32, 1 value, the enabled tracepoint categories of the tablet.
+ * Clearing a category writes the collected records to the log. Like the
+ * debug levels this is for use in the driver only and only enabled if
+ * the driver was built with tracepoints.
+ */
+#define WACOM_PROP_TRACE "Wacom Trace"
+
 /* BOOL, 1 value,
    TRUE == pressure renormalization enabled, FALSE == pressure renormalization disabled
 */
@@ -0,0 +1,80 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef WACOM_RECORDER_H_
+#define WACOM_RECORDER_H_
+
+#include <stdint.h>
+
+/* File format of a flight recorder dump, see the Wacom Flight Recorder
+ * property. A dump is a header followed by header.count records, oldest
+ * first. All values are in the byte order of the machine that wrote the
+ * dump.
+ */
+
+#define WACOM_RECORDER_MAGIC "WCMFLREC"
+#define WACOM_RECORDER_VERSION 1
+#define WACOM_RECORDER_RAW_SIZE 64 /* raw bytes per record */
+
+enum wacom_recorder_kind {
+	WACOM_RECORD_RAW = 1,	/* data handed to the model parser */
+	WACOM_RECORD_PARSE,	/* state as parsed, on entering wcmEvent */
+	WACOM_RECORD_FILTER,	/* state after filtering and suppression */
+	WACOM_RECORD_POST,	/* state handed to wcmSendEvents */
+};
+
+struct wacom_recorder_header {
+	char magic[8];		/* WACOM_RECORDER_MAGIC, not terminated */
+	uint32_t version;	/* WACOM_RECORDER_VERSION */
+	uint32_t count;		/* number of records in the dump */
+	uint32_t vendor_id;
+	uint32_t tablet_id;
+	uint64_t lost;		/* records overwritten before the dump */
+	uint64_t time_us;	/* monotonic time of the dump */
+};
+
+struct wacom_recorder_state {
+	int32_t device_id;
+	int32_t device_type;
+	uint32_t serial_num;
+	int32_t x;
+	int32_t y;
+	int32_t buttons;
+	int32_t pressure;
+	int32_t tiltx;
+	int32_t tilty;
+	int32_t rotation;
+	int32_t abswheel;
+	int32_t abswheel2;
+	int32_t relwheel;
+	int32_t distance;
+	int32_t throttle;
+	int32_t proximity;
+};
+
+struct wacom_recorder_record {
+	uint64_t time_us;	/* monotonic time of the record, the event time of a state */
+	uint32_t seq;		/* running record number */
+	uint8_t kind;		/* enum wacom_recorder_kind */
+	uint8_t len;		/* valid bytes in raw */
+	uint16_t channel;	/* channel of a state record */
+	union {
+		struct wacom_recorder_state state;
+		uint8_t raw[WACOM_RECORDER_RAW_SIZE];
+	} u;
+};
+
+#endif /* WACOM_RECORDER_H_ */
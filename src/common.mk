@@ -13,4 +13,8 @@ DRIVER_SOURCES= \
 	$(top_srcdir)/src/wcmXCommand.c \
 	$(top_srcdir)/src/wcmValidateDevice.c \
 	$(top_srcdir)/src/wcmTouchFilter.c \
-	$(top_srcdir)/src/wcmTouchFilter.h
+	$(top_srcdir)/src/wcmTouchFilter.h \
+	$(top_srcdir)/src/wcmLog.c \
+	$(top_srcdir)/src/wcmRecorder.c \
+	$(top_srcdir)/src/wcmTrace.c \
+	$(top_srcdir)/src/wcmTrace.h
@@ -24,9 +24,12 @@
 #include "xf86Wacom.h"
 #include "Xwacom.h"
 #include "wcmFilter.h"
+#include "wcmTrace.h"
 #include "wcmTouchFilter.h"
 #include <xkbsrv.h>
 #include <xf86_OSproc.h>
+#include <time.h>
+#include <strings.h>
 
 
 struct _WacomDriverRec WACOM_DRIVER = {
@@ -55,9 +58,6 @@ static int *VCOPY(const int *valuators, int nvals)
  ****************************************************************************/
 
 static int applyPressureCurve(WacomDevicePtr pDev, const WacomDeviceStatePtr pState);
-static void commonDispatchDevice(InputInfoPtr pInfo,
-				 const WacomChannelPtr pChannel,
-				 enum WacomSuppressMode suppress);
 static void sendAButton(InputInfoPtr pInfo, int button, int mask,
 			int first_val, int num_vals, int *valuators);
 
@@ -89,6 +89,96 @@ void set_absolute(InputInfoPtr pInfo, Bool absolute)
 		priv->flags &= ~ABSOLUTE_FLAG;
 }
 
+/**
+ * @return The current time in microseconds on the monotonic clock, the
+ * clock evdev devices timestamp their events with.
+ */
+uint64_t wcmTimeUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @return The current time in nanoseconds on the monotonic clock.
+ */
+uint64_t wcmTimeNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @return The latency histogram bucket for the given latency in
+ * microseconds, see WacomDeviceRec.latency.
+ */
+TEST_NON_STATIC int wcmLatencyBucket(uint64_t latency_us)
+{
+	int bucket = 0;
+
+	latency_us >>= LATENCY_BUCKET_SHIFT;
+	while (latency_us && bucket < LATENCY_BUCKETS - 1)
+	{
+		latency_us >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/**
+ * Account the time between the kernel timestamp of a state and now in the
+ * device's latency histogram. Called right after the state was posted.
+ * States without a timestamp (synthesized ones) or stamped on a different
+ * clock are ignored.
+ */
+void wcmRecordLatency(WacomDevicePtr priv, uint64_t time_us)
+{
+	uint64_t now;
+
+	if (!time_us)
+		return;
+
+	now = wcmTimeUs();
+	if (now < time_us)
+		return;
+
+	priv->latency[wcmLatencyBucket(now - time_us)]++;
+}
+
+/**
+ * Fill in the Wacom Statistics property values for this device, the
+ * tablet-wide counters come from the common.
+ *
+ * @param values STAT_COUNT values, in enum WacomStatistic order
+ */
+void wcmGetStatistics(WacomDevicePtr priv, uint32_t *values)
+{
+	WacomCommonPtr common = priv->common;
+	int i;
+
+	for (i = 0; i < STAT_COUNT; i++)
+	{
+		switch (i)
+		{
+			case STAT_SUPPRESSED_ALL:
+			case STAT_SUPPRESSED_NON_MOTION:
+			case STAT_ARBITRATION_LOST:
+			case STAT_POSTED:
+			case STAT_POSTED_HIGH:
+				values[i] = priv->stats[i];
+				break;
+			default:
+				values[i] = common->wcmStats[i];
+				break;
+		}
+	}
+}
+
 /*****************************************************************************
  * wcmSendButtons --
  *   Send button events by comparing the current button mask with the
@@ -610,9 +700,6 @@ wcmSendNonPadEvents(InputInfoPtr pInfo, const WacomDeviceState *ds,
 
 void wcmSendEvents(InputInfoPtr pInfo, const WacomDeviceState* ds)
 {
-#ifdef DEBUG
-	int is_button = !!(ds->buttons);
-#endif
 	int type = ds->device_type;
 	int id = ds->device_id;
 	unsigned int serial = ds->serial_num;
@@ -623,7 +710,7 @@ void wcmSendEvents(InputInfoPtr pInfo, const WacomDeviceState* ds)
 	int ty = ds->tilty;
 	WacomDevicePtr priv = (WacomDevicePtr) pInfo->private;
 	int v3, v4, v5, v6;
-	int valuators[priv->naxes];
+	int valuators[7]; /* all axes, some tools post fewer */
 
 	if (priv->serial && serial != priv->serial)
 	{
@@ -649,13 +736,6 @@ void wcmSendEvents(InputInfoPtr pInfo, const WacomDeviceState* ds)
 		ty = ds->stripy;
 	}
 
-	DBG(7, priv, "[%s] o_prox=%s x=%d y=%d z=%d "
-		"b=%s b=%d tx=%d ty=%d wl=%d wl2=%d rot=%d th=%d\n",
-		pInfo->type_name,
-		priv->oldState.proximity ? "true" : "false",
-		x, y, z, is_button ? "true" : "false", ds->buttons,
-		tx, ty, ds->abswheel, ds->abswheel2, ds->rotation, ds->throttle);
-
 	if (ds->proximity)
 		wcmRotateAndScaleCoordinates(pInfo, &x, &y);
 
@@ -681,13 +761,9 @@ void wcmSendEvents(InputInfoPtr pInfo, const WacomDeviceState* ds)
 				(double)MAX_ABS_WHEEL + MIN_ROTATION;
 	}
 
-	DBG(6, priv, "%s prox=%d\tx=%d"
-		"\ty=%d\tz=%d\tv3=%d\tv4=%d\tv5=%d\tv6=%d\tid=%d"
-		"\tserial=%u\tbutton=%s\tbuttons=%d\n",
-		is_absolute(pInfo) ? "abs" : "rel",
-		ds->proximity,
-		x, y, z, v3, v4, v5, v6, id, serial,
-		is_button ? "true" : "false", ds->buttons);
+	TRACE(TRACE_SEND, priv->common, TP_SEND, ds->proximity, x, y, z,
+	      ds->buttons);
+	TRACE(TRACE_SEND, priv->common, TP_SEND_AXES, v3, v4, v5, v6, serial);
 
 	/* when entering prox, replace the zeroed-out oldState with a copy of
 	 * the current state to prevent jumps. reset the prox and button state
@@ -716,6 +792,9 @@ void wcmSendEvents(InputInfoPtr pInfo, const WacomDeviceState* ds)
 			wcmSendNonPadEvents(pInfo, ds, 0, priv->naxes, valuators);
 	}
 
+	wcmStatAdd(priv->stats, STAT_POSTED, 1);
+	wcmRecordLatency(priv, ds->time_us);
+
 	if (ds->proximity)
 		wcmUpdateOldState(pInfo, ds, x, y);
 	else
@@ -727,12 +806,53 @@ void wcmSendEvents(InputInfoPtr pInfo, const WacomDeviceState* ds)
 	}
 }
 
+/**
+ * Set the suppress level and derive the per-axis thresholds from it.
+ *
+ * Historically the level was used as is on every axis. It still is on
+ * axes without a known range. x/y thresholds are a physical distance of
+ * level * 10um converted to the resolution of the pen or touch sensor.
+ * Pressure and tilt are scaled with their range, relative to a
+ * FILTER_PRESSURE_RES pressure range and a +/-64 tilt range. A derived
+ * threshold never drops below 1 while suppression is enabled, low
+ * resolution axes would otherwise stop being filtered at all.
+ *
+ * @param level Suppress level, 0 disables suppression on all axes.
+ */
+void wcmSetSuppress(WacomCommonPtr common, int level)
+{
+	int *threshold = common->wcmSuppressAxis;
+	int i;
+
+	common->wcmSuppress = level;
+	for (i = 0; i < SUPPRESS_AXIS_COUNT; i++)
+		threshold[i] = level;
+
+	if (common->wcmResolX)
+		threshold[SUPPRESS_AXIS_X] = (int64_t)level * common->wcmResolX / SUPPRESS_RESOLUTION;
+	if (common->wcmResolY)
+		threshold[SUPPRESS_AXIS_Y] = (int64_t)level * common->wcmResolY / SUPPRESS_RESOLUTION;
+	if (common->wcmTouchResolX)
+		threshold[SUPPRESS_AXIS_TOUCH_X] = (int64_t)level * common->wcmTouchResolX / SUPPRESS_RESOLUTION;
+	if (common->wcmTouchResolY)
+		threshold[SUPPRESS_AXIS_TOUCH_Y] = (int64_t)level * common->wcmTouchResolY / SUPPRESS_RESOLUTION;
+	if (common->wcmMaxZ)
+		threshold[SUPPRESS_AXIS_PRESSURE] = level * (common->wcmMaxZ + 1) / FILTER_PRESSURE_RES;
+	if (common->wcmTiltMaxX > common->wcmTiltMinX)
+		threshold[SUPPRESS_AXIS_TILT] = level * (common->wcmTiltMaxX - common->wcmTiltMinX + 1) / 128;
+
+	if (level > 0)
+		for (i = 0; i < SUPPRESS_AXIS_COUNT; i++)
+			threshold[i] = max(threshold[i], 1);
+}
+
 /**
  * Determine whether device state has changed enough to warrant further
  * processing. The driver's "suppress" setting decides how much
- * movement/state change must occur before we process events to avoid
- * overloading the server with minimal changes (and getting fuzzy events).
- * wcmCheckSuppress ensures that events meet this standard.
+ * movement/state change must occur on each axis before we process events
+ * to avoid overloading the server with minimal changes (and getting fuzzy
+ * events), see wcmSetSuppress. wcmCheckSuppress ensures that events meet
+ * this standard in a single pass over the state.
  *
  * @param dsOrig Previous device state
  * @param dsNew Current device state
@@ -746,46 +866,43 @@ wcmCheckSuppress(WacomCommonPtr common,
 		 const WacomDeviceState* dsOrig,
 		 WacomDeviceState* dsNew)
 {
-	int suppress = common->wcmSuppress;
-	enum WacomSuppressMode returnV = SUPPRESS_NONE;
+	const int *threshold = common->wcmSuppressAxis;
+	const int *xy;
+	int rotation = abs(dsOrig->rotation - dsNew->rotation);
+	int changed;
+	enum WacomSuppressMode returnV;
 
 	/* Ignore all other changes that occur after initial out-of-prox. */
 	if (!dsNew->proximity && !dsOrig->proximity)
 		return SUPPRESS_ALL;
 
-	/* Never ignore proximity changes. */
-	if (dsOrig->proximity != dsNew->proximity) goto out;
-
-	if (dsOrig->buttons != dsNew->buttons) goto out;
-	if (dsOrig->stripx != dsNew->stripx) goto out;
-	if (dsOrig->stripy != dsNew->stripy) goto out;
-
-	/* FIXME: we should have different suppress values for different
-	 * axes with vastly different ranges.
-	 */
-	if (abs(dsOrig->tiltx - dsNew->tiltx) > suppress) goto out;
-	if (abs(dsOrig->tilty - dsNew->tilty) > suppress) goto out;
-	if (abs(dsOrig->pressure - dsNew->pressure) > suppress) goto out;
-	if (abs(dsOrig->throttle - dsNew->throttle) > suppress) goto out;
-	if (abs(dsOrig->rotation - dsNew->rotation) > suppress &&
-	    (1800 - abs(dsOrig->rotation - dsNew->rotation)) >  suppress) goto out;
-
-	/* look for change in absolute wheel position 
-	 * or any relative wheel movement
-	 */
-	if (abs(dsOrig->abswheel  - dsNew->abswheel)  > suppress) goto out;
-	if (abs(dsOrig->abswheel2 - dsNew->abswheel2) > suppress) goto out;
-	if (dsNew->relwheel != 0) goto out;
+	/* Never ignore proximity, button and strip changes or any relative
+	 * wheel movement. Everything else only counts once it moved
+	 * further than the threshold of its axis. */
+	changed = (dsOrig->proximity != dsNew->proximity) |
+		  (dsOrig->buttons != dsNew->buttons) |
+		  (dsOrig->stripx != dsNew->stripx) |
+		  (dsOrig->stripy != dsNew->stripy) |
+		  (dsNew->relwheel != 0) |
+		  (abs(dsOrig->tiltx - dsNew->tiltx) > threshold[SUPPRESS_AXIS_TILT]) |
+		  (abs(dsOrig->tilty - dsNew->tilty) > threshold[SUPPRESS_AXIS_TILT]) |
+		  (abs(dsOrig->pressure - dsNew->pressure) > threshold[SUPPRESS_AXIS_PRESSURE]) |
+		  (abs(dsOrig->throttle - dsNew->throttle) > threshold[SUPPRESS_AXIS_THROTTLE]) |
+		  (rotation > threshold[SUPPRESS_AXIS_ROTATION] &&
+		   MAX_ROTATION_RANGE - rotation > threshold[SUPPRESS_AXIS_ROTATION]) |
+		  (abs(dsOrig->abswheel  - dsNew->abswheel)  > threshold[SUPPRESS_AXIS_WHEEL]) |
+		  (abs(dsOrig->abswheel2 - dsNew->abswheel2) > threshold[SUPPRESS_AXIS_WHEEL]);
+
+	returnV = changed ? SUPPRESS_NONE : SUPPRESS_ALL;
 
-	returnV = SUPPRESS_ALL;
-
-out:
 	/* Special handling for cursor: if nothing else changed but the
 	 * pointer x/y, suppress all but cursor movement. This return value
-	 * is used in commonDispatchDevice to short-cut event processing.
+	 * is used in stageRelative to short-cut event processing.
 	 */
-	if ((abs(dsOrig->x - dsNew->x) > suppress) || 
-			(abs(dsOrig->y - dsNew->y) > suppress)) 
+	xy = threshold + (dsNew->device_type == TOUCH_ID ?
+			  SUPPRESS_AXIS_TOUCH_X : SUPPRESS_AXIS_X);
+	if ((abs(dsOrig->x - dsNew->x) > xy[0]) ||
+			(abs(dsOrig->y - dsNew->y) > xy[1]))
 	{
 		if (returnV == SUPPRESS_ALL)
 			returnV = SUPPRESS_NON_MOTION;
@@ -796,11 +913,65 @@ out:
 		dsNew->y = dsOrig->y;
 	}
 
-	DBG(10, common, "level = %d"
-		" return value = %d\n", suppress, returnV);
+	TRACE(TRACE_SUPPRESS, common, TP_SUPPRESS, dsNew->device_type,
+	      common->wcmSuppress, returnV, 0, 0);
 	return returnV;
 }
 
+static WacomToolPtr* toolHashBucket(WacomCommonPtr common,
+				    int typeid, unsigned int serial)
+{
+	return &common->wcmToolHash[(serial ^ (serial >> 8) ^ typeid) &
+				    (TOOL_HASH_SIZE - 1)];
+}
+
+/**
+ * @return The default tool slot for a single DEVICE_ID type bit or NULL
+ * for anything else.
+ */
+static WacomToolPtr* toolDefaultSlot(WacomCommonPtr common, int typeid)
+{
+	if (typeid <= 0 || typeid & (typeid - 1) || ffs(typeid) > TOOL_TYPE_SLOTS)
+		return NULL;
+
+	return &common->wcmToolDefault[ffs(typeid) - 1];
+}
+
+/**
+ * Rebuild the findTool index from common->wcmTool. Must be called
+ * whenever a tool is added to or removed from the list, or a listed tool
+ * changes its type or serial.
+ */
+void wcmRebuildToolIndex(WacomCommonPtr common)
+{
+	WacomToolPtr tool;
+
+	memset(common->wcmToolHash, 0, sizeof(common->wcmToolHash));
+	memset(common->wcmToolDefault, 0, sizeof(common->wcmToolDefault));
+	common->wcmLastTool = NULL;
+
+	for (tool = common->wcmTool; tool; tool = tool->next)
+	{
+		tool->hash_next = NULL;
+
+		if (tool->serial)
+		{
+			WacomToolPtr *bucket = toolHashBucket(common, tool->typeid, tool->serial);
+
+			/* keep list order within a bucket, first match wins */
+			while (*bucket)
+				bucket = &(*bucket)->hash_next;
+			*bucket = tool;
+		} else
+		{
+			WacomToolPtr *slot = toolDefaultSlot(common, tool->typeid);
+
+			if (slot && !*slot)
+				*slot = tool;
+		}
+	}
+}
+
 /**
  * Find the device the current events are meant for. If multiple tools are
  * configured on this tablet, the one that matches the serial number for the
@@ -810,29 +981,39 @@ out:
  * @param ds The current device state as read from the fd
  * @return The tool that should be used to emit the current events.
  */
-static WacomToolPtr findTool(const WacomCommonPtr common,
-			     const WacomDeviceState *ds)
+TEST_NON_STATIC WacomToolPtr findTool(WacomCommonPtr common,
+				      const WacomDeviceState *ds)
 {
-	WacomToolPtr tooldefault = NULL;
 	WacomToolPtr tool = NULL;
+	WacomToolPtr *slot;
+
+	/* the same tool usually stays in proximity for many events */
+	if (common->wcmLastTool &&
+	    common->wcmLastToolType == ds->device_type &&
+	    common->wcmLastToolSerial == ds->serial_num)
+		return common->wcmLastTool;
 
 	/* 1: Find the tool (the one with correct serial or in second
 	 * hand, the one with serial set to 0 if no match with the
 	 * specified serial exists) that is used for this event */
-	for (tool = common->wcmTool; tool; tool = tool->next)
+	if (ds->serial_num)
 	{
-		if (tool->typeid == ds->device_type)
-		{
-			if (tool->serial == ds->serial_num)
-				break;
-			else if (!tool->serial)
-				tooldefault = tool;
-		}
+		tool = *toolHashBucket(common, ds->device_type, ds->serial_num);
+		while (tool && (tool->typeid != ds->device_type ||
+				tool->serial != ds->serial_num))
+			tool = tool->hash_next;
 	}
 
 	/* Use default tool (serial == 0) if no specific was found */
-	if (!tool)
-		tool = tooldefault;
+	if (!tool && (slot = toolDefaultSlot(common, ds->device_type)))
+		tool = *slot;
+
+	if (tool)
+	{
+		common->wcmLastTool = tool;
+		common->wcmLastToolType = ds->device_type;
+		common->wcmLastToolSerial = ds->serial_num;
+	}
 
 	return tool;
 }
@@ -863,7 +1044,7 @@ static Bool check_arbitrated_control(InputInfoPtr pInfo, WacomDeviceStatePtr ds)
 		/* Cursor devices are often left idle in range, so allow touch to
 		 * grab control if the tool has not been used for some time.
 		 */
-		return (ds->time - active->oldState.time > 100);
+		return ((int64_t)(ds->time_us - active->oldState.time_us) > 100000);
 	}
 	else if (IsTouch(active) && IsCursor(priv)) {
 		/* An otherwise idle cursor may still occasionally jitter and send
@@ -878,142 +1059,6 @@ static Bool check_arbitrated_control(InputInfoPtr pInfo, WacomDeviceStatePtr ds)
 	}
 }
 
-/*****************************************************************************
- * wcmEvent -
- *   Handles suppression, transformation, filtering, and event dispatch.
- ****************************************************************************/
-
-void wcmEvent(WacomCommonPtr common, unsigned int channel,
-	const WacomDeviceState* pState)
-{
-	WacomDeviceState* pLast;
-	WacomDeviceState ds;
-	WacomChannelPtr pChannel;
-	enum WacomSuppressMode suppress;
-	InputInfoPtr pInfo;
-	WacomToolPtr tool;
-	WacomDevicePtr priv;
-	pChannel = common->wcmChannel + channel;
-	pLast = &pChannel->valid.state;
-
-	DBG(10, common, "channel = %d\n", channel);
-
-	/* sanity check the channel */
-	if (channel >= MAX_CHANNELS)
-		return;
-	
-	/* we must copy the state because certain types of filtering
-	 * will need to change the values (ie. for error correction) */
-	ds = *pState;
-
-	DBG(10, common,
-		"c=%d i=%d t=%d s=%u x=%d y=%d b=%d "
-		"p=%d rz=%d tx=%d ty=%d aw=%d aw2=%d rw=%d "
-		"t=%d px=%d st=%d cs=%d \n",
-		channel,
-		ds.device_id,
-		ds.device_type,
-		ds.serial_num,
-		ds.x, ds.y, ds.buttons,
-		ds.pressure, ds.rotation, ds.tiltx,
-		ds.tilty, ds.abswheel, ds.abswheel2, ds.relwheel, ds.throttle,
-		ds.proximity, ds.sample,
-		pChannel->nSamples);
-
-	/* Find the device the current events are meant for */
-	tool = findTool(common, &ds);
-	if (!tool || !tool->device)
-	{
-		DBG(11, common, "no device matches with id=%d, serial=%u\n",
-		    ds.device_type, ds.serial_num);
-		return;
-	}
-
-	/* Tool on the tablet when driver starts. This sometime causes
-	 * access errors to the device */
-	if (!tool->enabled) {
-		LogMessageVerbSigSafe(X_ERROR, 0, "tool not initialized yet. Skipping event. \n");
-		return;
-	}
-
-	pInfo = tool->device;
-	priv = pInfo->private;
-	DBG(11, common, "tool id=%d for %s\n", ds.device_type, pInfo->name);
-
-	if (TabletHasFeature(common, WCM_ROTATION) &&
-		TabletHasFeature(common, WCM_RING) &&
-		ds.device_type == CURSOR_ID) /* I4 mouse */
-	{
-		/* convert Intuos4 mouse tilt to rotation */
-		ds.rotation = wcmTilt2R(ds.tiltx, ds.tilty,
-					INTUOS4_CURSOR_ROTATION_OFFSET);
-		ds.tiltx = 0;
-		ds.tilty = 0;
-	}
-
-	/* Optionally filter values only while in proximity */
-	if (ds.proximity && ds.device_type != PAD_ID)
-	{
-		/* Start filter fresh when entering proximity */
-		if (!pLast->proximity)
-			wcmResetSampleCounter(pChannel);
-
-		wcmFilterCoord(common,pChannel,&ds);
-	}
-
-	/* skip event if we don't have enough movement */
-	suppress = wcmCheckSuppress(common, pLast, &ds);
-	if (suppress == SUPPRESS_ALL)
-		return;
-
-	/* JEJ - Do not move this code without discussing it with me.
-	 * The device state is invariant of any filtering performed below.
-	 * Changing the device state after this point can and will cause
-	 * a feedback loop resulting in oscillations, error amplification,
-	 * unnecessary quantization, and other annoying effects. */
-
-	/* save channel device state and device to which last event went */
-	memmove(pChannel->valid.states + 1,
-		pChannel->valid.states,
-		sizeof(WacomDeviceState) * (common->wcmRawSample - 1));
-	pChannel->valid.state = ds; /*save last raw sample */
-	if (pChannel->nSamples < common->wcmRawSample) ++pChannel->nSamples;
-
-	/* arbitrate pointer control */
-	if (check_arbitrated_control(pInfo, &ds)) {
-		if (WACOM_DRIVER.active != NULL && priv != WACOM_DRIVER.active) {
-			wcmSoftOutEvent(WACOM_DRIVER.active->pInfo);
-			wcmCancelGesture(WACOM_DRIVER.active->pInfo);
-		}
-		if (ds.proximity)
-			WACOM_DRIVER.active = priv;
-		else
-			WACOM_DRIVER.active = NULL;
-	}
-	else if (!IsPad(priv)) {
-		return;
-	}
-
-	if ((ds.device_type == TOUCH_ID) && common->wcmTouch)
-	{
-		wcmGestureFilter(priv, ds.serial_num - 1);
-#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 16
-		/*
-		 * When using XI 2.2 multitouch events don't do common dispatching
-		 * for direct touch devices
-		 */
-		if (!common->wcmGesture && TabletHasFeature(common, WCM_LCD))
-			return;
-#endif
-	}
-
-	/* For touch, only first finger moves the cursor */
-	if ((common->wcmTouch && ds.device_type == TOUCH_ID && ds.serial_num == 1) ||
-	    (ds.device_type != TOUCH_ID))
-		commonDispatchDevice(pInfo, pChannel, suppress);
-}
-
-
 /**
  * Return the minimum pressure based on the current minimum pressure and the
  * hardware state. This is mainly to deal with the case where heavily used
@@ -1156,90 +1201,239 @@ static void detectPressureIssue(WacomDevicePtr priv,
 	priv->eventCnt++;
 }
 
-static void commonDispatchDevice(InputInfoPtr pInfo,
-				 const WacomChannelPtr pChannel,
-				 enum WacomSuppressMode suppress)
+/*****************************************************************************
+ * Event pipeline
+ *
+ * wcmEvent runs each state through the stages in enum WacomStage. A stage
+ * returns FALSE to drop the state, the remaining stages are skipped then.
+ * Which stages a device runs is decided once by wcmInitStages, stages only
+ * check what may change at runtime.
+ ****************************************************************************/
+
+typedef struct {
+	WacomCommonPtr common;
+	WacomChannelPtr channel;
+	InputInfoPtr pInfo;
+	WacomDevicePtr priv;
+	WacomDeviceState ds;		/* raw state, saved to the channel history */
+	WacomDeviceState filtered;	/* state sent to the server */
+	enum WacomSuppressMode suppress;
+	int raw_pressure;
+	int prev_min_pressure;
+} WacomEventContext;
+
+typedef Bool (*WacomStageProc)(WacomEventContext *ctx);
+
+static Bool stageTilt2Rotation(WacomEventContext *ctx)
 {
-	WacomDeviceState* ds = &pChannel->valid.states[0];
-	WacomDevicePtr priv = pInfo->private;
-	WacomCommonPtr common = priv->common;
-	WacomDeviceState filtered;
-	int raw_pressure = 0;
+	/* convert Intuos4 mouse tilt to rotation */
+	ctx->ds.rotation = wcmTilt2R(ctx->ds.tiltx, ctx->ds.tilty,
+				     INTUOS4_CURSOR_ROTATION_OFFSET);
+	ctx->ds.tiltx = 0;
+	ctx->ds.tilty = 0;
+	return TRUE;
+}
+
+static Bool stageFilter(WacomEventContext *ctx)
+{
+	/* Optionally filter values only while in proximity */
+	if (ctx->ds.proximity)
+	{
+		/* Start filter fresh when entering proximity */
+		if (!wcmChannelState(ctx->channel, 0)->proximity)
+			wcmResetSampleCounter(ctx->channel);
+
+		wcmFilterCoord(ctx->common, ctx->channel, &ctx->ds);
+	}
+	return TRUE;
+}
+
+static Bool stageSuppress(WacomEventContext *ctx)
+{
+	/* skip event if we don't have enough movement */
+	ctx->suppress = wcmCheckSuppress(ctx->common,
+					 wcmChannelState(ctx->channel, 0),
+					 &ctx->ds);
+	if (ctx->suppress == SUPPRESS_ALL)
+		ctx->priv->stats[STAT_SUPPRESSED_ALL]++;
+	else if (ctx->suppress == SUPPRESS_NON_MOTION)
+		ctx->priv->stats[STAT_SUPPRESSED_NON_MOTION]++;
+	return ctx->suppress != SUPPRESS_ALL;
+}
+
+static Bool stageHistory(WacomEventContext *ctx)
+{
+	WacomChannelPtr pChannel = ctx->channel;
+
+	/* JEJ - Do not move this code without discussing it with me.
+	 * The device state is invariant of any filtering performed below.
+	 * Changing the device state after this point can and will cause
+	 * a feedback loop resulting in oscillations, error amplification,
+	 * unnecessary quantization, and other annoying effects. */
+
+	/* save channel device state and device to which last event went,
+	 * the oldest state in the ring is overwritten */
+	pChannel->valid.head = (pChannel->valid.head + 1) % MAX_SAMPLES;
+	*wcmChannelState(pChannel, 0) = ctx->ds; /*save last raw sample */
+	if (pChannel->nSamples < ctx->common->wcmRawSample) ++pChannel->nSamples;
+
+	wcmRecordState(ctx->common, WACOM_RECORD_FILTER,
+		       pChannel - ctx->common->wcmChannel, &ctx->ds);
+	return TRUE;
+}
+
+static Bool stageArbitrate(WacomEventContext *ctx)
+{
+	WacomDevicePtr priv = ctx->priv;
+
+	/* arbitrate pointer control */
+	if (!check_arbitrated_control(ctx->pInfo, &ctx->ds))
+	{
+		priv->stats[STAT_ARBITRATION_LOST]++;
+		return FALSE;
+	}
+
+	if (WACOM_DRIVER.active != NULL && priv != WACOM_DRIVER.active) {
+		wcmSoftOutEvent(WACOM_DRIVER.active->pInfo);
+		wcmCancelGesture(WACOM_DRIVER.active->pInfo);
+	}
+	if (ctx->ds.proximity)
+		WACOM_DRIVER.active = priv;
+	else
+		WACOM_DRIVER.active = NULL;
+	return TRUE;
+}
+
+static Bool stageGesture(WacomEventContext *ctx)
+{
+	WacomCommonPtr common = ctx->common;
+
+	if (!common->wcmTouch)
+		return FALSE;
+
+	wcmGestureFilter(ctx->priv, ctx->ds.serial_num - 1, ctx->ds.time);
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 16
+	/*
+	 * When using XI 2.2 multitouch events don't do common dispatching
+	 * for direct touch devices
+	 */
+	if (!common->wcmGesture && TabletHasFeature(common, WCM_LCD))
+		return FALSE;
+#endif
+
+	/* For touch, only first finger moves the cursor */
+	return ctx->ds.serial_num == 1;
+}
+
+static Bool stageSerial(WacomEventContext *ctx)
+{
+	WacomDevicePtr priv = ctx->priv;
+
+	/* the gesture code may have changed the saved state */
+	ctx->filtered = *wcmChannelState(ctx->channel, 0);
 
 	/* device_type should have been retrieved and set in the respective
 	 * models, wcmISDV4.c or wcmUSB.c. Once it comes here, something
 	 * must have been wrong. Ignore the events.
 	 */
-	if (!ds->device_type)
+	if (!ctx->filtered.device_type)
 	{
-		DBG(11, common, "no device type matches with"
-				" serial=%u\n", ds->serial_num);
-		return;
+		DBG(11, ctx->common, "no device type matches with"
+				" serial=%u\n", ctx->filtered.serial_num);
+		return FALSE;
 	}
 
-	DBG(10, common, "device type = %d\n", ds->device_type);
-
-	filtered = pChannel->valid.state;
-
 	/* Device transformations come first */
-	if (priv->serial && filtered.serial_num != priv->serial)
+	if (priv->serial && ctx->filtered.serial_num != priv->serial)
 	{
 		DBG(10, priv, "serial number"
 			" is %u but your system configured %u",
-			filtered.serial_num, priv->serial);
-		return;
+			ctx->filtered.serial_num, priv->serial);
+		return FALSE;
 	}
+	return TRUE;
+}
 
-	if ((IsPen(priv) || IsTouch(priv)) && common->wcmMaxZ)
-	{
-		int prev_min_pressure = priv->oldState.proximity ? priv->minPressure : 0;
-
-		detectPressureIssue(priv, common, &filtered);
-
-		raw_pressure = filtered.pressure;
-		if (!priv->oldState.proximity)
-			priv->maxRawPressure = raw_pressure;
-
-		priv->minPressure = rebasePressure(priv, &filtered);
-
-		filtered.pressure = normalizePressure(priv, filtered.pressure);
-		if (IsPen(priv)) {
-			filtered.buttons = setPressureButton(priv,
-							     filtered.buttons,
-							     filtered.pressure);
-
-			/* Here we run some heuristics to avoid losing button events if the
-			 * pen gets pushed onto the tablet so quickly that the first pressure
-			 * event read is non-zero and is thus interpreted as a pressure bias */
-			if (filtered.buttons & PRESSURE_BUTTON) {
-				/* If we triggered 'normally' reset max pressure to
-				 * avoid to trigger again while this device is in proximity */
-				priv->maxRawPressure = 0;
-			} else if (priv->maxRawPressure) {
-				int norm_max_pressure;
-
-				/* If we haven't triggered normally we record the maximal pressure
-				 * and see if this would have triggered with a lowered bias. */
-				if (priv->maxRawPressure < raw_pressure)
-					priv->maxRawPressure = raw_pressure;
-				norm_max_pressure = normalizePressure(priv, priv->maxRawPressure);
-				filtered.buttons = setPressureButton(priv, filtered.buttons,
-								     norm_max_pressure);
-
-				/* If minPressure is not decrementing any more or a button
-				 * press has been generated or minPressure has just become zero
-				 * reset maxRawPressure to avoid that worn devices
-				 * won't report a button release until going out of proximity */
-				if ((filtered.buttons & PRESSURE_BUTTON &&
-				     priv->minPressure == prev_min_pressure) ||
-				    !priv->minPressure)
-					priv->maxRawPressure = 0;
+static Bool stagePredict(WacomEventContext *ctx)
+{
+	WacomCommonPtr common = ctx->common;
 
-			}
-		}
-		filtered.pressure = applyPressureCurve(priv,&filtered);
+	/* the history keeps the real position, only what's sent leads.
+	 * Turned off, this still drops the channel's lead. */
+	wcmPredictCoord(common, ctx->channel, &ctx->filtered,
+			common->wcmPredict * 1000);
+	return TRUE;
+}
+
+static Bool stagePressure(WacomEventContext *ctx)
+{
+	WacomDevicePtr priv = ctx->priv;
+
+	ctx->prev_min_pressure = priv->oldState.proximity ? priv->minPressure : 0;
+
+	detectPressureIssue(priv, ctx->common, &ctx->filtered);
+
+	ctx->raw_pressure = ctx->filtered.pressure;
+	if (!priv->oldState.proximity)
+		priv->maxRawPressure = ctx->raw_pressure;
+
+	priv->minPressure = rebasePressure(priv, &ctx->filtered);
+
+	ctx->filtered.pressure = normalizePressure(priv, ctx->filtered.pressure);
+	return TRUE;
+}
+
+static Bool stagePressureButton(WacomEventContext *ctx)
+{
+	WacomDevicePtr priv = ctx->priv;
+	WacomDeviceState *filtered = &ctx->filtered;
+
+	filtered->buttons = setPressureButton(priv,
+					      filtered->buttons,
+					      filtered->pressure);
+
+	/* Here we run some heuristics to avoid losing button events if the
+	 * pen gets pushed onto the tablet so quickly that the first pressure
+	 * event read is non-zero and is thus interpreted as a pressure bias */
+	if (filtered->buttons & PRESSURE_BUTTON) {
+		/* If we triggered 'normally' reset max pressure to
+		 * avoid to trigger again while this device is in proximity */
+		priv->maxRawPressure = 0;
+	} else if (priv->maxRawPressure) {
+		int norm_max_pressure;
+
+		/* If we haven't triggered normally we record the maximal pressure
+		 * and see if this would have triggered with a lowered bias. */
+		if (priv->maxRawPressure < ctx->raw_pressure)
+			priv->maxRawPressure = ctx->raw_pressure;
+		norm_max_pressure = normalizePressure(priv, priv->maxRawPressure);
+		filtered->buttons = setPressureButton(priv, filtered->buttons,
+						      norm_max_pressure);
+
+		/* If minPressure is not decrementing any more or a button
+		 * press has been generated or minPressure has just become zero
+		 * reset maxRawPressure to avoid that worn devices
+		 * won't report a button release until going out of proximity */
+		if ((filtered->buttons & PRESSURE_BUTTON &&
+		     priv->minPressure == ctx->prev_min_pressure) ||
+		    !priv->minPressure)
+			priv->maxRawPressure = 0;
 	}
-	else if (IsCursor(priv) && !priv->oldCursorHwProx)
+	return TRUE;
+}
+
+static Bool stagePressureCurve(WacomEventContext *ctx)
+{
+	ctx->filtered.pressure = applyPressureCurve(ctx->priv, &ctx->filtered);
+	return TRUE;
+}
+
+static Bool stageCursorProx(WacomEventContext *ctx)
+{
+	WacomDevicePtr priv = ctx->priv;
+	WacomCommonPtr common = ctx->common;
+
+	if (!priv->oldCursorHwProx)
 	{
 		/* initial current max distance for Intuos series */
 		if ((TabletHasFeature(common, WCM_ROTATION)) ||
@@ -1250,80 +1444,269 @@ static void commonDispatchDevice(InputInfoPtr pInfo,
 	}
 
 	/* Store cursor hardware prox for next use */
-	if (IsCursor(priv))
-		priv->oldCursorHwProx = ds->proximity;
+	priv->oldCursorHwProx = ctx->ds.proximity;
+	return TRUE;
+}
+
+static Bool stageRelative(WacomEventContext *ctx)
+{
+	WacomDevicePtr priv = ctx->priv;
+	double deltx, delty;
 
-	/* User-requested filtering comes next */
+	if (is_absolute(ctx->pInfo))
+		return TRUE;
 
-	/* User-requested transformations come last */
+	/* To improve the accuracy of relative x/y,
+	 * don't send motion event when there is no movement.
+	 */
+	deltx = ctx->filtered.x - priv->oldState.x;
+	delty = ctx->filtered.y - priv->oldState.y;
 
-	if (!is_absolute(pInfo) && !IsPad(priv))
+	/* less than one device coordinate movement? */
+	if (abs(deltx)<1 && abs(delty)<1)
 	{
-		/* To improve the accuracy of relative x/y,
-		 * don't send motion event when there is no movement.
-		 */
-		double deltx = filtered.x - priv->oldState.x;
-		double delty = filtered.y - priv->oldState.y;
-
-		/* less than one device coordinate movement? */
-		if (abs(deltx)<1 && abs(delty)<1)
+		/* We have no other data in this event, skip */
+		if (ctx->suppress == SUPPRESS_NON_MOTION)
 		{
-			/* We have no other data in this event, skip */
-			if (suppress == SUPPRESS_NON_MOTION)
-			{
-				DBG(10, common, "Ignore non-movement relative data \n");
-				return;
-			}
-
-			/* send other events, such as button/wheel */
-			filtered.x = priv->oldState.x;
-			filtered.y = priv->oldState.y;
+			DBG(10, ctx->common, "Ignore non-movement relative data \n");
+			return FALSE;
 		}
+
+		/* send other events, such as button/wheel */
+		ctx->filtered.x = priv->oldState.x;
+		ctx->filtered.y = priv->oldState.y;
 	}
+	return TRUE;
+}
+
+static Bool stageProxout(WacomEventContext *ctx)
+{
+	WacomCommonPtr common = ctx->common;
+	WacomDeviceState *filtered = &ctx->filtered;
 
 	/* force out-prox when distance is outside wcmCursorProxoutDist for pucks */
-	if (IsCursor(priv))
+	if (common->wcmProtocolLevel == WCM_PROTOCOL_5)
 	{
-		if (common->wcmProtocolLevel == WCM_PROTOCOL_5)
-		{
-			/* protocol 5 distance starts from the MaxDist
-			 * when getting in the prox.
-			 */
-			if (common->wcmMaxCursorDist > filtered.distance)
-				common->wcmMaxCursorDist = filtered.distance;
-		}
-		else
-		{
-			/* protocol 4 distance is 0 when getting in the prox */
-			if (common->wcmMaxCursorDist < filtered.distance)
-				common->wcmMaxCursorDist = filtered.distance;
-		}
-		DBG(10, common, "Distance over"
-				" the tablet: %d, ProxoutDist: %d current"
-				" min/max %d hard prox: %d\n",
-				filtered.distance,
-				common->wcmCursorProxoutDist,
-				common->wcmMaxCursorDist,
-				ds->proximity);
+		/* protocol 5 distance starts from the MaxDist
+		 * when getting in the prox.
+		 */
+		if (common->wcmMaxCursorDist > filtered->distance)
+			common->wcmMaxCursorDist = filtered->distance;
+	}
+	else
+	{
+		/* protocol 4 distance is 0 when getting in the prox */
+		if (common->wcmMaxCursorDist < filtered->distance)
+			common->wcmMaxCursorDist = filtered->distance;
+	}
+	DBG(10, common, "Distance over"
+			" the tablet: %d, ProxoutDist: %d current"
+			" min/max %d hard prox: %d\n",
+			filtered->distance,
+			common->wcmCursorProxoutDist,
+			common->wcmMaxCursorDist,
+			ctx->ds.proximity);
+
+	if (ctx->priv->oldState.proximity)
+	{
+		if (abs(filtered->distance - common->wcmMaxCursorDist)
+				> common->wcmCursorProxoutDist)
+			filtered->proximity = 0;
+	}
+	/* once it is out. Don't let it in until a hard in */
+	/* or it gets inside wcmCursorProxoutDist */
+	else
+	{
+		if (abs(filtered->distance - common->wcmMaxCursorDist) >
+				common->wcmCursorProxoutDist && ctx->ds.proximity)
+			return FALSE;
+		if (!ctx->ds.proximity)
+			return FALSE;
+	}
+	return TRUE;
+}
 
-		if (priv->oldState.proximity)
-		{
-			if (abs(filtered.distance - common->wcmMaxCursorDist)
-					> common->wcmCursorProxoutDist)
-				filtered.proximity = 0;
-		}
-		/* once it is out. Don't let it in until a hard in */
-		/* or it gets inside wcmCursorProxoutDist */
-		else
+static Bool stageSend(WacomEventContext *ctx)
+{
+	wcmRecordState(ctx->common, WACOM_RECORD_POST,
+		       ctx->channel - ctx->common->wcmChannel, &ctx->filtered);
+	wcmSendEvents(ctx->pInfo, &ctx->filtered);
+	return TRUE;
+}
+
+static const WacomStageProc stageProcs[STAGE_COUNT] = {
+	[STAGE_TILT2ROTATION] = stageTilt2Rotation,
+	[STAGE_FILTER] = stageFilter,
+	[STAGE_SUPPRESS] = stageSuppress,
+	[STAGE_HISTORY] = stageHistory,
+	[STAGE_ARBITRATE] = stageArbitrate,
+	[STAGE_GESTURE] = stageGesture,
+	[STAGE_SERIAL] = stageSerial,
+	[STAGE_PREDICT] = stagePredict,
+	[STAGE_PRESSURE] = stagePressure,
+	[STAGE_PRESSURE_BUTTON] = stagePressureButton,
+	[STAGE_PRESSURE_CURVE] = stagePressureCurve,
+	[STAGE_CURSOR_PROX] = stageCursorProx,
+	[STAGE_RELATIVE] = stageRelative,
+	[STAGE_PROXOUT] = stageProxout,
+	[STAGE_SEND] = stageSend,
+};
+
+static const char *stageNames[STAGE_COUNT] = {
+	[STAGE_TILT2ROTATION] = "tilt2rotation",
+	[STAGE_FILTER] = "filter",
+	[STAGE_SUPPRESS] = "suppress",
+	[STAGE_HISTORY] = "history",
+	[STAGE_ARBITRATE] = "arbitrate",
+	[STAGE_GESTURE] = "gesture",
+	[STAGE_SERIAL] = "serial",
+	[STAGE_PREDICT] = "predict",
+	[STAGE_PRESSURE] = "pressure",
+	[STAGE_PRESSURE_BUTTON] = "pressure-button",
+	[STAGE_PRESSURE_CURVE] = "pressure-curve",
+	[STAGE_CURSOR_PROX] = "cursor-prox",
+	[STAGE_RELATIVE] = "relative",
+	[STAGE_PROXOUT] = "proxout",
+	[STAGE_SEND] = "send",
+};
+
+const char *wcmStageName(enum WacomStage stage)
+{
+	return stageNames[stage];
+}
+
+/**
+ * Log the per-stage counters of this device, if StageTiming is enabled.
+ */
+void wcmLogStages(WacomDevicePtr priv)
+{
+	int i;
+
+	if (!priv->stageTiming)
+		return;
+
+	for (i = 0; i < priv->nstages; i++)
+	{
+		const WacomStageStats *stats = &priv->stageStats[priv->stages[i]];
+
+		xf86Msg(X_INFO, "%s: stage %-15s %llu events, %.1f ns/event\n",
+			priv->name, stageNames[priv->stages[i]],
+			(unsigned long long)stats->events,
+			stats->events ? (double)stats->ns / stats->events : 0.0);
+	}
+}
+
+/**
+ * Decide which stages of the event pipeline apply to this device. Must be
+ * called once the device type and the tablet features and ranges are
+ * known.
+ */
+void wcmInitStages(WacomDevicePtr priv)
+{
+	WacomCommonPtr common = priv->common;
+	Bool pressure = (IsPen(priv) || IsTouch(priv)) && common->wcmMaxZ;
+	Bool use[STAGE_COUNT] = {
+		[STAGE_TILT2ROTATION] = IsCursor(priv) &&
+					TabletHasFeature(common, WCM_ROTATION) &&
+					TabletHasFeature(common, WCM_RING),
+		[STAGE_FILTER] = !IsPad(priv),
+		[STAGE_SUPPRESS] = TRUE,
+		[STAGE_HISTORY] = TRUE,
+		/* Pad may never be the "active" pointer controller */
+		[STAGE_ARBITRATE] = !IsPad(priv),
+		[STAGE_GESTURE] = IsTouch(priv),
+		[STAGE_SERIAL] = TRUE,
+		[STAGE_PREDICT] = IsPen(priv),
+		[STAGE_PRESSURE] = pressure,
+		[STAGE_PRESSURE_BUTTON] = pressure && IsPen(priv),
+		[STAGE_PRESSURE_CURVE] = pressure,
+		[STAGE_CURSOR_PROX] = IsCursor(priv),
+		[STAGE_RELATIVE] = !IsPad(priv),
+		[STAGE_PROXOUT] = IsCursor(priv),
+		[STAGE_SEND] = TRUE,
+	};
+	int i;
+
+	priv->nstages = 0;
+	for (i = 0; i < STAGE_COUNT; i++)
+		if (use[i])
+			priv->stages[priv->nstages++] = i;
+}
+
+/*****************************************************************************
+ * wcmEvent -
+ *   Handles suppression, transformation, filtering, and event dispatch.
+ ****************************************************************************/
+
+void wcmEvent(WacomCommonPtr common, unsigned int channel,
+	const WacomDeviceState* pState)
+{
+	WacomEventContext ctx;
+	WacomChannelPtr pChannel;
+	WacomToolPtr tool;
+	WacomDevicePtr priv;
+	uint64_t start = 0;
+	int i;
+
+	/* sanity check the channel */
+	if (channel >= common->wcmChannelCnt)
+		return;
+
+	pChannel = common->wcmChannel + channel;
+
+	wcmRecordState(common, WACOM_RECORD_PARSE, channel, pState);
+
+	TRACE(TRACE_EVENT, common, TP_EVENT, channel, pState->device_type,
+	      pState->serial_num, pState->x, pState->y);
+	TRACE(TRACE_EVENT, common, TP_EVENT_AXES, pState->pressure,
+	      pState->buttons, pState->proximity, pState->tiltx, pState->tilty);
+
+	/* Find the device the current events are meant for */
+	tool = findTool(common, pState);
+	if (!tool || !tool->device)
+	{
+		TRACE(TRACE_EVENT, common, TP_EVENT_NO_TOOL, channel,
+		      pState->device_type, pState->serial_num, 0, 0);
+		return;
+	}
+
+	/* Tool on the tablet when driver starts. This sometime causes
+	 * access errors to the device */
+	if (!tool->enabled) {
+		wcmLogDeferred(common, LOG_TOOL_NOT_INITIALIZED, 0, 0, 0);
+		return;
+	}
+
+	priv = tool->device->private;
+
+	ctx.common = common;
+	ctx.channel = pChannel;
+	ctx.pInfo = tool->device;
+	ctx.priv = priv;
+	/* we must copy the state because certain types of filtering
+	 * will need to change the values (ie. for error correction) */
+	ctx.ds = *pState;
+	ctx.suppress = SUPPRESS_NONE;
+
+	if (priv->stageTiming)
+		start = wcmTimeNs();
+
+	for (i = 0; i < priv->nstages; i++)
+	{
+		WacomStageStats *stats = &priv->stageStats[priv->stages[i]];
+		Bool keep = stageProcs[priv->stages[i]](&ctx);
+
+		stats->events++;
+		if (priv->stageTiming)
 		{
-			if (abs(filtered.distance - common->wcmMaxCursorDist) >
-					common->wcmCursorProxoutDist && ds->proximity)
-				return;
-			if (!ds->proximity)
-				return;
+			uint64_t now = wcmTimeNs();
+
+			stats->ns += now - start;
+			start = now;
 		}
+		if (!keep)
+			break;
 	}
-	wcmSendEvents(pInfo, &filtered);
 }
 
 /*****************************************************************************
@@ -1440,6 +1823,55 @@ void wcmRotateTablet(InputInfoPtr pInfo, int value)
  *
  */
 
+/**
+ * Size the channel array for the given number of touch contacts, plus one
+ * channel for stylus/mouse and one for the pad. The array only grows, the
+ * pad stays on the last channel.
+ *
+ * @return FALSE if the allocation failed, the old channels stay in place.
+ */
+Bool wcmAllocChannels(WacomCommonPtr common, int contacts)
+{
+	int count = max(min(contacts, MAX_CONTACTS), MIN_CONTACTS) + 2;
+	int old_count = common->wcmChannelCnt;
+	WacomChannel *channels;
+	unsigned long *masks;
+	int i;
+
+	if (count <= old_count)
+		return TRUE;
+
+	channels = calloc(count, sizeof(WacomChannel));
+	/* dirty and busy bits share one allocation */
+	masks = calloc(2 * NBITS(count), sizeof(unsigned long));
+	if (!channels || !masks)
+	{
+		free(channels);
+		free(masks);
+		return FALSE;
+	}
+
+	for (i = 0; i < old_count; i++)
+	{
+		int to = (i == old_count - 1) ? count - 1 : i;
+
+		channels[to] = common->wcmChannel[i];
+		if (ISBITSET(common->wcmDirtyChannels, i))
+			SETBIT(masks, to);
+		if (ISBITSET(common->wcmBusyChannels, i))
+			SETBIT(masks + NBITS(count), to);
+	}
+
+	free(common->wcmChannel);
+	free(common->wcmDirtyChannels);
+	common->wcmChannel = channels;
+	common->wcmDirtyChannels = masks;
+	common->wcmBusyChannels = masks + NBITS(count);
+	common->wcmChannelCnt = count;
+
+	return TRUE;
+}
+
 WacomCommonPtr wcmNewCommon(void)
 {
 	WacomCommonPtr common;
@@ -1447,6 +1879,12 @@ WacomCommonPtr wcmNewCommon(void)
 	if (!common)
 		return NULL;;
 
+	if (!wcmAllocChannels(common, 0))
+	{
+		free(common);
+		return NULL;
+	}
+
 	common->refcnt = 1;
 	common->wcmFlags = 0;               /* various flags */
 	common->wcmProtocolLevel = WCM_PROTOCOL_4; /* protocol level */
@@ -1462,11 +1900,19 @@ WacomCommonPtr wcmNewCommon(void)
 	common->wcmMaxStripY = 4096;       /* Max fingerstrip Y */
 	common->wcmCursorProxoutDistDefault = PROXOUT_INTUOS_DISTANCE;
 			/* default to Intuos */
-	common->wcmSuppress = DEFAULT_SUPPRESS;
+	wcmSetSuppress(common, DEFAULT_SUPPRESS);
 			/* transmit position if increment is superior */
 	common->wcmRawSample = DEFAULT_SAMPLES;
 			/* number of raw data to be used to for filtering */
+	common->wcmFilterMode = FILTER_MODE_AVERAGE;
+			/* how the raw data is filtered */
 	common->wcmPressureRecalibration = 1;
+	common->wcmReadBudget = DEFAULT_READ_BUDGET;
+			/* reads per wakeup before yielding */
+	common->wcmRecorder = calloc(RECORDER_SIZE, sizeof(*common->wcmRecorder));
+			/* flight recorder, not fatal if it's missing */
+	common->wcmLogTimer = TimerSet(NULL, 0, 0, NULL, NULL);
+			/* flushes deferred messages */
 	return common;
 }
 
@@ -1478,6 +1924,8 @@ void wcmFreeCommon(WacomCommonPtr *ptr)
 	DBG(10, common, "common refcount dec to %d\n", common->refcnt - 1);
 	if (--common->refcnt == 0)
 	{
+		TimerFree(common->wcmLogTimer);
+		wcmLogFlush(common);
 		free(common->private);
 		while (common->serials)
 		{
@@ -1493,6 +1941,11 @@ void wcmFreeCommon(WacomCommonPtr *ptr)
 			common->serials = next;
 		}
 		free(common->device_path);
+		free(common->wcmChannel);
+		free(common->wcmDirtyChannels);
+		free(common->wcmTraceRing);
+		free(common->wcmRecorder);
+		free(common->wcmRecorderDir);
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 16
 		free(common->touch_mask);
 #endif
@@ -23,6 +23,7 @@
 
 #include "xf86Wacom.h"
 #include "wcmFilter.h"
+#include "wcmTrace.h"
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -33,7 +34,8 @@
  * Allocate the generic bits needed by any wacom device, regardless of type.
  ****************************************************************************/
 
-static int wcmAllocate(InputInfoPtr pInfo)
+TEST_NON_STATIC int
+wcmAllocate(InputInfoPtr pInfo)
 {
 	WacomDevicePtr   priv   = NULL;
 	WacomCommonPtr   common = NULL;
@@ -176,6 +178,7 @@ wcmSetType(InputInfoPtr pInfo, const char *type)
 		return 0;
 
 	priv->tool->typeid = DEVICE_ID(priv->flags); /* tool type (stylus/touch/eraser/cursor/pad) */
+	wcmRebuildToolIndex(priv->common);
 
 	return 1;
 
@@ -281,6 +284,7 @@ static void wcmUninit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
 			prev_tool = &tool->next;
 			tool = tool->next;
 		}
+		wcmRebuildToolIndex(common);
 	}
 
 	prev = &common->wcmDevices;
@@ -637,6 +641,14 @@ static int wcmPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
 
 	common->debugLevel = xf86SetIntOption(pInfo->options,
 					      "CommonDBG", common->debugLevel);
+	if (!wcmSetTraceMask(common, xf86SetIntOption(pInfo->options, "Trace",
+						      common->wcmTraceMask)))
+		xf86Msg(X_WARNING, "%s: failed to allocate the trace ring\n",
+			pInfo->name);
+	if (!common->wcmRecorderDir)
+		common->wcmRecorderDir = xf86SetStrOption(pInfo->options,
+							  "FlightRecorderDir",
+							  RECORDER_DIR);
 	oldname = strdup(pInfo->name);
 
 	if (wcmIsHotpluggedDevice(pInfo))
@@ -668,6 +680,8 @@ static int wcmPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
 	if (!wcmPostInitParseOptions(pInfo, need_hotplug, is_dependent))
 		goto SetupProc_fail;
 
+	wcmInitStages(priv);
+
 	if (need_hotplug)
 	{
 		priv->isParent = 1;
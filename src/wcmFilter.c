@@ -36,6 +36,34 @@ static int filterOnLine(double x0, double y0, double x1, double y1,
 		double a, double b);
 static void filterLine(int* pCurve, int nMax, int x0, int y0, int x1, int y1);
 
+/*****************************************************************************
+ * Coordinate filters
+ *
+ * wcmFilterCoord runs x and y through the filter picked with the Wacom
+ * Filter Mode property. The sliding average lags (RawSample - 1) / 2
+ * samples behind the pen. The One-Euro filter opens up as the pen moves
+ * faster, the Kalman filter tracks the pen's velocity and doesn't lag on
+ * strokes at constant speed. Both are tuned to leave as much jitter on a
+ * resting pen as the sliding average over RawSample samples, at reports
+ * every FILTER_INTERVAL.
+ ****************************************************************************/
+
+#define ONE_EURO_TAU		2500	/* us at rest, per sample in the window */
+#define ONE_EURO_BETA		1000	/* mHz more cutoff per mm/s of speed */
+#define ONE_EURO_D_CUTOFF	1000	/* mHz, cutoff of the speed estimate */
+
+/* converts a cutoff in mHz to a time constant in us and back */
+#define MHZ_TAU(x)		(159154943 / (x))
+
+#define KALMAN_R		(1LL << 30)	/* measurement noise */
+#define KALMAN_P11		KALMAN_R	/* initial velocity variance */
+
+/* Kalman process noise per RawSample, per ms^3 */
+static const int64_t kalmanNoise[MAX_SAMPLES + 1] = {
+	0, 0, 1365656, 173517, 44519, 16374, 7415, 3745, 2116, 1274, 809,
+	536, 371, 265, 194, 146, 112, 86, 68, 55, 45
+};
+
 
 /*****************************************************************************
  * wcmCheckPressureCurveValues -- check pressure curve values for sanity.
@@ -213,57 +241,166 @@ static void filterLine(int* pCurve, int nMax, int x0, int y0, int x1, int y1)
 		}
 	}
 }
-static void storeRawSample(WacomCommonPtr common, WacomChannelPtr pChannel,
+/**
+ * Add the sample to the raw sample ring.
+ *
+ * @return TRUE if the filter started over with this sample
+ */
+static Bool storeRawSample(WacomCommonPtr common, WacomChannelPtr pChannel,
 			   WacomDeviceStatePtr ds)
 {
 	WacomFilterState *fs;
 	int i;
 
 	fs = &pChannel->rawFilter;
-	if (!fs->npoints)
+	if (!fs->npoints || fs->window != common->wcmRawSample)
 	{
 		DBG(10, common, "initialize channel data.\n");
 		/* Store initial value over whole average window */
-		for (i=common->wcmRawSample - 1; i>=0; i--)
+		fs->window = common->wcmRawSample;
+		fs->head = 0;
+		for (i = 0; i < fs->window; i++)
 		{
-			fs->x[i]= ds->x;
-			fs->y[i]= ds->y;
+			fs->x[i] = ds->x;
+			fs->y[i] = ds->y;
+			fs->tiltx[i] = ds->tiltx;
+			fs->tilty[i] = ds->tilty;
 		}
-		if (HANDLE_TILT(common) && (ds->device_type == STYLUS_ID ||
-					    ds->device_type == ERASER_ID))
+		fs->sum_x = ds->x * fs->window;
+		fs->sum_y = ds->y * fs->window;
+		fs->sum_tiltx = ds->tiltx * fs->window;
+		fs->sum_tilty = ds->tilty * fs->window;
+		fs->npoints = 1;
+
+		memset(fs->axis, 0, sizeof(fs->axis));
+		fs->axis[0].pos = (int64_t)ds->x << 16;
+		fs->axis[1].pos = (int64_t)ds->y << 16;
+		for (i = 0; i < ARRAY_SIZE(fs->axis); i++)
 		{
-			for (i=common->wcmRawSample - 1; i>=0; i--)
-			{
-				fs->tiltx[i] = ds->tiltx;
-				fs->tilty[i] = ds->tilty;
-			}
-		}
-		++fs->npoints;
-	} else {
-		/* Shift window and insert latest sample */
-		for (i=common->wcmRawSample - 1; i>0; i--)
-		{
-			fs->x[i]= fs->x[i-1];
-			fs->y[i]= fs->y[i-1];
-		}
-		fs->x[0] = ds->x;
-		fs->y[0] = ds->y;
-		if (HANDLE_TILT(common) && (ds->device_type == STYLUS_ID ||
-					    ds->device_type == ERASER_ID))
-		{
-			for (i=common->wcmRawSample - 1; i>0; i--)
-			{
-				fs->tiltx[i]= fs->tiltx[i-1];
-				fs->tilty[i]= fs->tilty[i-1];
-			}
-			fs->tiltx[0] = ds->tiltx;
-			fs->tilty[0] = ds->tilty;
+			fs->axis[i].p00 = KALMAN_R;
+			fs->axis[i].p11 = KALMAN_P11;
 		}
-		if (fs->npoints < common->wcmRawSample)
-			++fs->npoints;
+		return TRUE;
 	}
+
+	/* Replace the oldest sample with the latest one */
+	i = fs->head;
+	fs->sum_x += ds->x - fs->x[i];
+	fs->sum_y += ds->y - fs->y[i];
+	fs->sum_tiltx += ds->tiltx - fs->tiltx[i];
+	fs->sum_tilty += ds->tilty - fs->tilty[i];
+	fs->x[i] = ds->x;
+	fs->y[i] = ds->y;
+	fs->tiltx[i] = ds->tiltx;
+	fs->tilty[i] = ds->tilty;
+	fs->head = (i + 1 < fs->window) ? i + 1 : 0;
+	if (fs->npoints < fs->window)
+		++fs->npoints;
+	return FALSE;
+}
+
+static void filterAverage(WacomCommonPtr common, WacomFilterState *fs,
+			  WacomDeviceStatePtr ds, int64_t dt)
+{
+	ds->x = fs->sum_x / fs->window;
+	ds->y = fs->sum_y / fs->window;
+}
+
+/* smoothing factor of a low-pass with time constant tau, 16.16 */
+static int64_t lowPassAlpha(int64_t tau, int64_t dt)
+{
+	return (dt << 16) / (dt + tau);
 }
 
+/**
+ * One-Euro filter: a low-pass whose cutoff goes up with the pen's speed.
+ * At rest its time constant is ONE_EURO_TAU per sample in the window.
+ *
+ * @param resolution Resolution of the axis in points/m, 0 if unknown
+ */
+static void oneEuroAxis(WacomFilterAxis *axis, int *value, int64_t dt,
+			int window, int resolution)
+{
+	int64_t z = (int64_t)*value << 16;
+	int64_t speed, fc;
+
+	speed = (z - axis->pos) * 1000000 / dt;
+	axis->vel += lowPassAlpha(MHZ_TAU(ONE_EURO_D_CUTOFF), dt) *
+		     (speed - axis->vel) >> 16;
+
+	fc = MHZ_TAU(ONE_EURO_TAU * (window - 1));
+	if (resolution > 0)
+		fc += ONE_EURO_BETA * llabs(axis->vel) * 1000 /
+		      ((int64_t)resolution << 16);
+
+	axis->pos += lowPassAlpha(MHZ_TAU(fc), dt) * (z - axis->pos) >> 16;
+	*value = (axis->pos + (1 << 15)) >> 16;
+}
+
+static void filterOneEuro(WacomCommonPtr common, WacomFilterState *fs,
+			  WacomDeviceStatePtr ds, int64_t dt)
+{
+	Bool touch = (ds->device_type == TOUCH_ID);
+
+	oneEuroAxis(&fs->axis[0], &ds->x, dt, fs->window,
+		    touch ? common->wcmTouchResolX : common->wcmResolX);
+	oneEuroAxis(&fs->axis[1], &ds->y, dt, fs->window,
+		    touch ? common->wcmTouchResolY : common->wcmResolY);
+}
+
+/**
+ * Constant velocity Kalman filter. Covariances are relative to the
+ * measurement noise KALMAN_R, time is in ms.
+ *
+ * @param q Process noise, see kalmanNoise
+ */
+static void kalmanAxis(WacomFilterAxis *axis, int *value, int64_t dt,
+		       int64_t q)
+{
+	int64_t z = (int64_t)*value << 16;
+	int64_t q00, q01, q11, s, k0, k1, p01, y;
+
+	/* predict */
+	q11 = q * dt / 1000;
+	q01 = q11 * dt / 2000;
+	q00 = q01 * dt * 2 / 3000;
+	axis->pos += axis->vel * dt / 1000;
+	axis->p00 += (2 * axis->p01 + axis->p11 * dt / 1000) * dt / 1000 + q00;
+	axis->p01 += axis->p11 * dt / 1000 + q01;
+	axis->p11 += q11;
+
+	/* correct */
+	s = axis->p00 + KALMAN_R;
+	k0 = (axis->p00 << 16) / s;
+	k1 = (axis->p01 << 16) / s;
+	y = z - axis->pos;
+	axis->pos += k0 * y >> 16;
+	axis->vel += k1 * y >> 16;
+
+	p01 = axis->p01;
+	axis->p11 -= k1 * p01 >> 16;
+	axis->p01 -= k0 * p01 >> 16;
+	axis->p00 -= k0 * axis->p00 >> 16;
+
+	*value = (axis->pos + (1 << 15)) >> 16;
+}
+
+static void filterKalman(WacomCommonPtr common, WacomFilterState *fs,
+			 WacomDeviceStatePtr ds, int64_t dt)
+{
+	kalmanAxis(&fs->axis[0], &ds->x, dt, kalmanNoise[fs->window]);
+	kalmanAxis(&fs->axis[1], &ds->y, dt, kalmanNoise[fs->window]);
+}
+
+typedef void (*WacomFilterProc)(WacomCommonPtr common, WacomFilterState *fs,
+				WacomDeviceStatePtr ds, int64_t dt);
+
+static const WacomFilterProc filterProcs[FILTER_MODE_COUNT] = {
+	[FILTER_MODE_AVERAGE] = filterAverage,
+	[FILTER_MODE_ONE_EURO] = filterOneEuro,
+	[FILTER_MODE_KALMAN] = filterKalman,
+};
+
 /*****************************************************************************
  * wcmFilterCoord -- provide noise correction to all transducers
  ****************************************************************************/
@@ -271,39 +408,41 @@ static void storeRawSample(WacomCommonPtr common, WacomChannelPtr pChannel,
 int wcmFilterCoord(WacomCommonPtr common, WacomChannelPtr pChannel,
 	WacomDeviceStatePtr ds)
 {
-	int x=0, y=0, tx=0, ty=0, i;
 	WacomFilterState *state;
+	int64_t dt;
 
 	DBG(10, common, "common->wcmRawSample = %d \n", common->wcmRawSample);
 
-	storeRawSample(common, pChannel, ds);
-
 	state = &pChannel->rawFilter;
-
-	for ( i=0; i<common->wcmRawSample; i++ )
+	dt = (int64_t)(ds->time_us - state->time_us);
+
+	/* start over after a mode change. The velocity and Kalman state also
+	 * go stale in a gap in the reports, the sliding average has always
+	 * kept its window until the tool leaves proximity. */
+	if (state->mode != common->wcmFilterMode ||
+	    (state->mode != FILTER_MODE_AVERAGE && dt > FILTER_MAX_INTERVAL))
+		state->npoints = 0;
+	state->mode = common->wcmFilterMode;
+	state->time_us = ds->time_us;
+
+	/* the first sample and a window of one pass through unfiltered */
+	if (!storeRawSample(common, pChannel, ds) && state->window > 1)
 	{
-		x += state->x[i];
-		y += state->y[i];
-		if (HANDLE_TILT(common) && (ds->device_type == STYLUS_ID ||
-					    ds->device_type == ERASER_ID))
-		{
-			tx += state->tiltx[i];
-			ty += state->tilty[i];
-		}
+		if (dt <= 0)
+			dt = FILTER_INTERVAL;
+		filterProcs[state->mode](common, state, ds, dt);
 	}
-	ds->x = x / common->wcmRawSample;
-	ds->y = y / common->wcmRawSample;
 
 	if (HANDLE_TILT(common) && (ds->device_type == STYLUS_ID ||
 				    ds->device_type == ERASER_ID))
 	{
-		ds->tiltx = tx / common->wcmRawSample;
+		ds->tiltx = state->sum_tiltx / state->window;
 		if (ds->tiltx > common->wcmTiltMaxX)
 			ds->tiltx = common->wcmTiltMaxX;
 		else if (ds->tiltx < common->wcmTiltMinX)
 			ds->tiltx = common->wcmTiltMinX;
 
-		ds->tilty = ty / common->wcmRawSample;
+		ds->tilty = state->sum_tilty / state->window;
 		if (ds->tilty > common->wcmTiltMaxY)
 			ds->tilty = common->wcmTiltMaxY;
 		else if (ds->tilty < common->wcmTiltMinY)
@@ -313,6 +452,91 @@ int wcmFilterCoord(WacomCommonPtr common, WacomChannelPtr pChannel,
 	return 0; /* lookin' good */
 }
 
+/*****************************************************************************
+ * wcmPredictCoord -- extrapolate the pen position to hide latency
+ ****************************************************************************/
+
+/* put ds lead ahead of the newest state and remember what it came to */
+static void predictLead(WacomCommonPtr common, WacomChannelPtr pChannel,
+			WacomDeviceStatePtr ds, int dx, int dy)
+{
+	const WacomDeviceState *s0 = wcmChannelState(pChannel, 0);
+
+	ds->x = max(common->wcmMinX, min(common->wcmMaxX, s0->x + dx));
+	ds->y = max(common->wcmMinY, min(common->wcmMaxY, s0->y + dy));
+	pChannel->predictX = ds->x - s0->x;
+	pChannel->predictY = ds->y - s0->y;
+}
+
+static Bool predictDecay(WacomCommonPtr common, WacomChannelPtr pChannel,
+			 WacomDeviceStatePtr ds)
+{
+	predictLead(common, pChannel, ds,
+		    pChannel->predictX / 2, pChannel->predictY / 2);
+	return (pChannel->predictX || pChannel->predictY);
+}
+
+/**
+ * Move ds to where the pen is likely to be horizon us after the newest
+ * state in the channel history, from its velocity and acceleration over
+ * the last three states. Nothing new is predicted across button changes,
+ * gaps in the reports or turns sharper than 60 degrees, the extrapolation
+ * would overshoot there. The lead halves with each such report instead of
+ * snapping back at once. A new tool or proximity change drops it.
+ *
+ * @return TRUE if ds was moved
+ */
+Bool wcmPredictCoord(WacomCommonPtr common, WacomChannelPtr pChannel,
+	WacomDeviceStatePtr ds, int horizon)
+{
+	const WacomDeviceState *s0 = wcmChannelState(pChannel, 0);
+	const WacomDeviceState *s1 = wcmChannelState(pChannel, 1);
+	const WacomDeviceState *s2 = wcmChannelState(pChannel, 2);
+	double dt1, dt2, vx1, vy1, vx2, vy2, dot, dx, dy, ax, ay;
+
+	if (horizon <= 0 ||
+	    !s0->proximity || !s1->proximity || !s2->proximity ||
+	    s1->serial_num != s0->serial_num || s2->serial_num != s0->serial_num ||
+	    s1->device_type != s0->device_type || s2->device_type != s0->device_type)
+	{
+		pChannel->predictX = pChannel->predictY = 0;
+		return FALSE;
+	}
+
+	if (s0->buttons != s1->buttons || s1->buttons != s2->buttons)
+		return predictDecay(common, pChannel, ds);
+
+	if (s0->time_us <= s1->time_us || s1->time_us <= s2->time_us ||
+	    s0->time_us - s2->time_us > FILTER_MAX_INTERVAL)
+		return predictDecay(common, pChannel, ds);
+
+	dt1 = s0->time_us - s1->time_us;
+	dt2 = s1->time_us - s2->time_us;
+	vx1 = (s0->x - s1->x) / dt1;
+	vy1 = (s0->y - s1->y) / dt1;
+	vx2 = (s1->x - s2->x) / dt2;
+	vy2 = (s1->y - s2->y) / dt2;
+
+	/* a pen at rest or turning around, cos(60) = 1/2 */
+	dot = vx1 * vx2 + vy1 * vy2;
+	if (dot <= 0 ||
+	    4 * dot * dot < (vx1 * vx1 + vy1 * vy1) * (vx2 * vx2 + vy2 * vy2))
+		return predictDecay(common, pChannel, ds);
+
+	ax = (vx1 - vx2) * 2 / (dt1 + dt2);
+	ay = (vy1 - vy2) * 2 / (dt1 + dt2);
+
+	/* the acceleration is the noisier estimate, it may at most double
+	 * or cancel the velocity's share */
+	dx = vx1 * horizon;
+	dy = vy1 * horizon;
+	dx += max(-fabs(dx), min(fabs(dx), ax * horizon * horizon / 2));
+	dy += max(-fabs(dy), min(fabs(dy), ay * horizon * horizon / 2));
+
+	predictLead(common, pChannel, ds, round(dx), round(dy));
+	return TRUE;
+}
+
 /***
  * Convert a point (X/Y) in a left-handed coordinate system to a normalized
  * rotation angle.
@@ -29,6 +29,8 @@ void wcmSetPressureCurve(WacomDevicePtr pDev, int x0, int y0,
 int wcmFilterCoord(WacomCommonPtr common, WacomChannelPtr pChannel,
 	WacomDeviceStatePtr ds);
 void wcmResetSampleCounter(const WacomChannelPtr pChannel);
+Bool wcmPredictCoord(WacomCommonPtr common, WacomChannelPtr pChannel,
+	WacomDeviceStatePtr ds, int horizon);
 
 /****************************************************************************/
 #endif /* __XF86_WCMFILTER_H */
@@ -166,9 +166,7 @@ static int wcmSerialValidate(InputInfoPtr pInfo, const unsigned char* data)
 	if (!(data[0] & HEADER_BIT))
 	{
 		n = wcmSkipInvalidBytes(data, common->wcmPktLength);
-		LogMessageVerbSigSafe(X_WARNING, 0,
-			"%s: missing header bit. skipping %d bytes.\n",
-			pInfo->name, n);
+		wcmLogDeferred(common, LOG_MISSING_HEADER, n, 0, 0);
 		return n;
 	}
 
@@ -179,8 +177,8 @@ static int wcmSerialValidate(InputInfoPtr pInfo, const unsigned char* data)
 	n = wcmSkipInvalidBytes(&data[1], common->wcmPktLength - 1);
 	n += 1; /* the header byte we already checked */
 	if (n != common->wcmPktLength) {
-		LogMessageVerbSigSafe(X_WARNING, 0, "%s: bad data at %d v=%x l=%d\n", pInfo->name,
-			n, data[n], common->wcmPktLength);
+		wcmLogDeferred(common, LOG_BAD_DATA, n, data[n],
+			       common->wcmPktLength);
 		return n;
 	}
 
@@ -609,17 +607,17 @@ static int isdv4ParseTouchPacket(InputInfoPtr pInfo, const unsigned char *data,
 {
 	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
 	WacomCommonPtr common = priv->common;
-	WacomDeviceState* last = &common->wcmChannel[0].valid.state;
-	WacomDeviceState* lastTemp = &common->wcmChannel[1].valid.state;
+	WacomDeviceState* last = wcmChannelState(&common->wcmChannel[0], 0);
+	WacomDeviceState* lastTemp = wcmChannelState(&common->wcmChannel[1], 0);
 	ISDV4TouchData touchdata;
+	uint64_t now = wcmTimeUs();
 	int rc;
 	int channel = 0;
 
 	rc = isdv4ParseTouchData(data, len, common->wcmPktLength, &touchdata);
 	if (rc <= 0)
 	{
-		LogMessageVerbSigSafe(X_ERROR, 0, "%s: failed to parse touch data (err %d).\n",
-				      pInfo->name, rc);
+		wcmLogDeferred(common, LOG_TOUCH_PARSE_FAILED, rc, 0, 0);
 		return -1;
 	}
 
@@ -629,7 +627,7 @@ static int isdv4ParseTouchPacket(InputInfoPtr pInfo, const unsigned char *data,
 	ds->device_type = TOUCH_ID;
 	ds->device_id = TOUCH_DEVICE_ID;
 	ds->serial_num = 1;
-	ds->time = (int)GetTimeInMillis();
+	wcmSetStateTime(ds, now);
 
 	if (common->wcmPktLength == ISDV4_PKGLEN_TOUCH2FG)
 	{
@@ -642,7 +640,7 @@ static int isdv4ParseTouchPacket(InputInfoPtr pInfo, const unsigned char *data,
 				/* time stamp for 2FGT gesture events */
 				if ((ds->proximity && !last->proximity) ||
 				    (!ds->proximity && last->proximity))
-					ds->sample = (int)GetTimeInMillis();
+					ds->sample = ds->time;
 				wcmEvent(common, channel, ds);
 			}
 
@@ -655,11 +653,11 @@ static int isdv4ParseTouchPacket(InputInfoPtr pInfo, const unsigned char *data,
 			ds->device_id = TOUCH_DEVICE_ID;
 			ds->serial_num = 2;
 			ds->proximity = touchdata.finger2.status;
-			ds->time = (int)GetTimeInMillis();
+			wcmSetStateTime(ds, now);
 			/* time stamp for 2FGT gesture events */
 			if ((ds->proximity && !lastTemp->proximity) ||
 			    (!ds->proximity && lastTemp->proximity))
-				ds->sample = (int)GetTimeInMillis();
+				ds->sample = ds->time;
 		}
 	}
 
@@ -683,7 +681,7 @@ static int isdv4ParsePenPacket(InputInfoPtr pInfo, const unsigned char *data,
 {
 	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
 	WacomCommonPtr common = priv->common;
-	WacomDeviceState* last = &common->wcmChannel[0].valid.state;
+	WacomDeviceState* last = wcmChannelState(&common->wcmChannel[0], 0);
 	int rc;
 	ISDV4CoordinateData coord;
 	int channel = 0;
@@ -693,12 +691,11 @@ static int isdv4ParsePenPacket(InputInfoPtr pInfo, const unsigned char *data,
 
 	if (rc == -1)
 	{
-		LogMessageVerbSigSafe(X_ERROR, 0,
-				      "%s: failed to parse coordinate data.\n", pInfo->name);
+		wcmLogDeferred(common, LOG_COORD_PARSE_FAILED, 0, 0, 0);
 		return -1;
 	}
 
-	ds->time = (int)GetTimeInMillis();
+	wcmSetStateTime(ds, wcmTimeUs());
 	ds->proximity = coord.proximity;
 
 	/* x and y in "normal" orientetion (wide length is X) */
@@ -755,7 +752,7 @@ static int isdv4Parse(InputInfoPtr pInfo, const unsigned char* data, int len)
 {
 	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
 	WacomCommonPtr common = priv->common;
-	WacomDeviceState* last = &common->wcmChannel[0].valid.state;
+	WacomDeviceState* last = wcmChannelState(&common->wcmChannel[0], 0);
 	WacomDeviceState* ds;
 	int n, channel = 0;
 
@@ -824,6 +821,7 @@ static int isdv4Parse(InputInfoPtr pInfo, const unsigned char* data, int len)
 	if (channel < 0)
 		return 0;
 
+	wcmStatAdd(common->wcmStats, STAT_FRAMES, 1);
 	wcmEvent(common, channel, ds);
 	return common->wcmPktLength;
 }
@@ -0,0 +1,152 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "xf86Wacom.h"
+
+/*****************************************************************************
+ * Deferred logging
+ *
+ * Errors the input path runs into are counted in a fixed slot per message
+ * instead of being logged right away. A timer writes them to the log
+ * outside of input processing, one line per message with the number of
+ * repeats, and at most one line per message every LOG_RATE_LIMIT ms. A
+ * misbehaving tablet thus costs a few stores per event, not a log line.
+ ****************************************************************************/
+
+static const struct {
+	MessageType type;
+	const char *format;	/* up to LOG_ARGS int arguments */
+} logMessages[LOG_COUNT] = {
+	[LOG_TOOL_NOT_INITIALIZED] = { X_ERROR, "tool not initialized yet. Skipping event." },
+	[LOG_DEVICE_TYPE_MISMATCH] = { X_ERROR, "usbDispatchEvents: Device Type mismatch - %d -> %d. This is a BUG." },
+	[LOG_EVENT_QUEUE_EXCEEDED] = { X_ERROR, "usbParse: Exceeded event queue (%d), splitting frame (%u)" },
+	[LOG_INVALID_SERIAL] = { X_ERROR, "usbParse: Ignoring event from invalid serial 0" },
+	[LOG_REL_EVENT] = { X_ERROR, "rel event recv'd (%d)!" },
+	[LOG_MISSING_HEADER] = { X_WARNING, "missing header bit. skipping %d bytes." },
+	[LOG_BAD_DATA] = { X_WARNING, "bad data at %d v=%x l=%d" },
+	[LOG_TOUCH_PARSE_FAILED] = { X_ERROR, "failed to parse touch data (err %d)." },
+	[LOG_COORD_PARSE_FAILED] = { X_ERROR, "failed to parse coordinate data." },
+};
+
+/**
+ * Log the pending messages that aren't rate limited.
+ *
+ * @param now   Current time in microseconds
+ * @param force Log all pending messages, ignoring the rate limit
+ * @return Milliseconds until the next rate limited message may be logged,
+ * 0 if there is none pending.
+ */
+TEST_NON_STATIC CARD32 wcmLogFlushAt(WacomCommonPtr common, uint64_t now, Bool force)
+{
+	uint64_t next = 0;
+	int i;
+
+	for (i = 0; i < LOG_COUNT; i++)
+	{
+		WacomLogSlot *slot = &common->wcmLog[i];
+		char format[256];
+		unsigned int count;
+
+		if (!slot->pending)
+			continue;
+
+		if (!force && slot->last_us &&
+		    now - slot->last_us < LOG_RATE_LIMIT * 1000)
+		{
+			uint64_t wait = slot->last_us + LOG_RATE_LIMIT * 1000 - now;
+
+			if (!next || wait < next)
+				next = wait;
+			continue;
+		}
+
+		count = slot->pending;
+		if (count > 1)
+			snprintf(format, sizeof(format), "%%s: %s (%u times)\n",
+				 logMessages[i].format, count);
+		else
+			snprintf(format, sizeof(format), "%%s: %s\n",
+				 logMessages[i].format);
+
+		/* the formats come from logMessages */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+		xf86Msg(logMessages[i].type, format, common->device_path,
+			slot->args[0], slot->args[1], slot->args[2]);
+#pragma GCC diagnostic pop
+
+		slot->pending = 0;
+		slot->last_us = now;
+	}
+
+	return next ? (next + 999) / 1000 : 0;
+}
+
+static CARD32 logTimerFunc(OsTimerPtr timer, CARD32 time, pointer arg)
+{
+	WacomCommonPtr common = arg;
+	CARD32 next;
+	int sigstate;
+
+	sigstate = xf86BlockSIGIO();
+	next = wcmLogFlushAt(common, wcmTimeUs(), FALSE);
+	common->wcmLogArmed = (next != 0);
+	xf86UnblockSIGIO(sigstate);
+
+	return next;
+}
+
+/**
+ * Queue a message for the log. Safe to call from the input path: it only
+ * touches the message's slot and arms the pre-allocated flush timer.
+ *
+ * @param id    The message
+ * @param a,b,c Its arguments, only kept for the first occurrence until
+ *              the message is logged
+ */
+void wcmLogDeferred(WacomCommonPtr common, enum WacomLogId id, int a, int b, int c)
+{
+	WacomLogSlot *slot = &common->wcmLog[id];
+
+	if (slot->pending++ == 0)
+	{
+		slot->args[0] = a;
+		slot->args[1] = b;
+		slot->args[2] = c;
+	}
+
+	/* without a timer the messages wait for wcmLogFlush */
+	if (!common->wcmLogArmed && common->wcmLogTimer)
+	{
+		common->wcmLogArmed = TRUE;
+		TimerSet(common->wcmLogTimer, 0, LOG_FLUSH_DELAY, logTimerFunc, common);
+	}
+}
+
+/**
+ * Log all pending messages right away. Must not be called from the input
+ * path.
+ */
+void wcmLogFlush(WacomCommonPtr common)
+{
+	wcmLogFlushAt(common, wcmTimeUs(), TRUE);
+}
+
+/* vim: set noexpandtab tabstop=8 shiftwidth=8: */
@@ -0,0 +1,244 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "xf86Wacom.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+/*****************************************************************************
+ * Flight recorder
+ *
+ * Every tablet keeps the last RECORDER_SIZE raw packets and device states
+ * in a ring. A pen report of a USB tablet takes 3-4 raw entries of
+ * WACOM_RECORDER_RAW_SIZE bytes plus 3 states, so at 1 kHz the ring holds
+ * about the last four seconds. The input path is the only writer and
+ * advances the head once an entry is complete, then fences before it
+ * starts overwriting the next one. A dump copies the ring between two
+ * reads of the head, fenced the other way round, and drops the entries
+ * the input path may have overwritten meanwhile.
+ ****************************************************************************/
+
+static WacomRecorderEntry* recorderNext(WacomCommonPtr common)
+{
+	return &common->wcmRecorder[common->wcmRecorderHead & (RECORDER_SIZE - 1)];
+}
+
+static void recorderPush(WacomCommonPtr common)
+{
+	__atomic_store_n(&common->wcmRecorderHead, common->wcmRecorderHead + 1,
+			 __ATOMIC_RELEASE);
+	/* a dump that sees the next entry half written must see this head */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Record data handed to the model parser, split into as many entries as
+ * needed.
+ *
+ * @param time_us Time the data was handed over, see wcmTimeUs()
+ */
+void wcmRecordRaw(WacomCommonPtr common, uint64_t time_us,
+		  const unsigned char *data, int len)
+{
+	if (!common->wcmRecorder)
+		return;
+
+	while (len > 0)
+	{
+		WacomRecorderEntry *entry = recorderNext(common);
+		int n = min(len, WACOM_RECORDER_RAW_SIZE);
+
+		entry->time_us = time_us;
+		entry->kind = WACOM_RECORD_RAW;
+		entry->channel = 0;
+		entry->len = n;
+		memcpy(entry->u.raw, data, n);
+		recorderPush(common);
+
+		data += n;
+		len -= n;
+	}
+}
+
+/**
+ * Record a device state at one of the wcmEvent stages. The record carries
+ * the state's own timestamp.
+ *
+ * @param kind WACOM_RECORD_PARSE, WACOM_RECORD_FILTER or WACOM_RECORD_POST
+ */
+void wcmRecordState(WacomCommonPtr common, int kind, int channel,
+		    const WacomDeviceState *ds)
+{
+	WacomRecorderEntry *entry;
+
+	if (!common->wcmRecorder)
+		return;
+
+	entry = recorderNext(common);
+	entry->time_us = ds->time_us;
+	entry->kind = kind;
+	entry->channel = channel;
+	entry->len = sizeof(*ds);
+	entry->u.state = *ds;
+	recorderPush(common);
+}
+
+static void recorderConvertState(struct wacom_recorder_state *out,
+				 const WacomDeviceState *ds)
+{
+	out->device_id = ds->device_id;
+	out->device_type = ds->device_type;
+	out->serial_num = ds->serial_num;
+	out->x = ds->x;
+	out->y = ds->y;
+	out->buttons = ds->buttons;
+	out->pressure = ds->pressure;
+	out->tiltx = ds->tiltx;
+	out->tilty = ds->tilty;
+	out->rotation = ds->rotation;
+	out->abswheel = ds->abswheel;
+	out->abswheel2 = ds->abswheel2;
+	out->relwheel = ds->relwheel;
+	out->distance = ds->distance;
+	out->throttle = ds->throttle;
+	out->proximity = ds->proximity;
+}
+
+/**
+ * Write the recorder's content to fd in the format described in
+ * wacom-recorder.h.
+ *
+ * @return The number of records written or -1 on error
+ */
+TEST_NON_STATIC int wcmRecorderWrite(WacomCommonPtr common, int fd)
+{
+	struct wacom_recorder_header header = {{0}};
+	struct wacom_recorder_record *records;
+	WacomRecorderEntry *copy;
+	unsigned int first, last, i;
+	int n = 0, rc = -1;
+
+	if (!common->wcmRecorder)
+		return -1;
+
+	copy = malloc(RECORDER_SIZE * sizeof(*copy));
+	records = calloc(RECORDER_SIZE, sizeof(*records));
+	if (!copy || !records)
+		goto out;
+
+	first = __atomic_load_n(&common->wcmRecorderHead, __ATOMIC_ACQUIRE);
+	memcpy(copy, common->wcmRecorder, RECORDER_SIZE * sizeof(*copy));
+	/* the copy must not be reordered past the second read */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	last = __atomic_load_n(&common->wcmRecorderHead, __ATOMIC_RELAXED);
+
+	/* entries the input path wrote while we copied may be torn, so are
+	 * the ones they overwrote, and so is the oldest one: entry last may
+	 * already be half written over it. Everything from
+	 * last - RECORDER_SIZE + 1 up to first is intact. */
+	i = (last >= RECORDER_SIZE) ? last - RECORDER_SIZE + 1 : 0;
+	if (last - first >= RECORDER_SIZE)
+		i = first;
+
+	for (; i != first; i++)
+	{
+		const WacomRecorderEntry *entry = &copy[i & (RECORDER_SIZE - 1)];
+		struct wacom_recorder_record *rec = &records[n++];
+
+		rec->time_us = entry->time_us;
+		rec->seq = i;
+		rec->kind = entry->kind;
+		rec->channel = entry->channel;
+		if (entry->kind == WACOM_RECORD_RAW)
+		{
+			rec->len = entry->len;
+			memcpy(rec->u.raw, entry->u.raw, entry->len);
+		} else
+		{
+			rec->len = sizeof(rec->u.state);
+			recorderConvertState(&rec->u.state, &entry->u.state);
+		}
+	}
+
+	memcpy(header.magic, WACOM_RECORDER_MAGIC, sizeof(header.magic));
+	header.version = WACOM_RECORDER_VERSION;
+	header.count = n;
+	header.vendor_id = common->vendor_id;
+	header.tablet_id = common->tablet_id;
+	header.lost = first - n;
+	header.time_us = wcmTimeUs();
+
+	if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+	    write(fd, records, n * sizeof(*records)) != (ssize_t)(n * sizeof(*records)))
+		goto out;
+
+	rc = n;
+out:
+	free(records);
+	free(copy);
+	return rc;
+}
+
+/**
+ * Dump the flight recorder into a new file in the FlightRecorderDir.
+ * Called from the property handler, never from the input path.
+ *
+ * @return Success or BadAlloc if the dump could not be written
+ */
+int wcmRecorderDump(WacomCommonPtr common)
+{
+	char path[PATH_MAX];
+	long long now = time(NULL);
+	int fd, n, seq = 0;
+
+	/* dumps within the same second get a running number */
+	do {
+		snprintf(path, sizeof(path), "%s/wacom-flight-recorder-%04x-%lld-%d.bin",
+			 common->wcmRecorderDir ? common->wcmRecorderDir : RECORDER_DIR,
+			 common->tablet_id, now, seq);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	} while (fd < 0 && errno == EEXIST && ++seq < RECORDER_MAX_DUMPS);
+
+	if (fd < 0)
+	{
+		xf86Msg(X_ERROR, "%s: cannot create flight recorder dump %s: %s\n",
+			common->device_path, path, strerror(errno));
+		return BadAlloc;
+	}
+
+	n = wcmRecorderWrite(common, fd);
+	close(fd);
+
+	if (n < 0)
+	{
+		xf86Msg(X_ERROR, "%s: failed to write flight recorder dump %s\n",
+			common->device_path, path);
+		unlink(path);
+		return BadAlloc;
+	}
+
+	xf86Msg(X_INFO, "%s: wrote %d flight recorder records to %s\n",
+		common->device_path, n, path);
+	return Success;
+}
+
+/* vim: set noexpandtab tabstop=8 shiftwidth=8: */
@@ -62,10 +62,10 @@ static WacomChannelPtr getContactNumber(WacomCommonPtr common, int num)
 {
 	int i;
 
-	for (i = 0; i < MAX_CHANNELS; i++)
+	for (i = 0; i < common->wcmChannelCnt; i++)
 	{
 		WacomChannelPtr channel = common->wcmChannel+i;
-		WacomDeviceState state  = channel->valid.state;
+		WacomDeviceState state  = *wcmChannelState(channel, 0);
 		if (state.device_type == TOUCH_ID && state.serial_num == num + 1)
 			return channel;
 	}
@@ -89,12 +89,12 @@ static void getStateHistory(WacomCommonPtr common, WacomDeviceState states[], in
 	for (i = 0; i < num; i++)
 	{
 		WacomChannelPtr channel = getContactNumber(common, i);
-		if (channel == NULL || i > ARRAY_SIZE(channel->valid.states))
+		if (channel == NULL || age >= MAX_SAMPLES)
 		{
 			DBG(7, common, "Could not get state history for contact %d, age %d.\n", i, age);
 			continue;
 		}
-		states[i] = channel->valid.states[age];
+		states[i] = *wcmChannelState(channel, age);
 	}
 }
 
@@ -113,8 +113,8 @@ wcmSendTouchEvent(WacomDevicePtr priv, WacomChannelPtr channel, Bool no_update)
 {
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 16
 	ValuatorMask *mask = priv->common->touch_mask;
-	WacomDeviceState state = channel->valid.state;
-	WacomDeviceState oldstate = channel->valid.states[1];
+	WacomDeviceState state = *wcmChannelState(channel, 0);
+	WacomDeviceState oldstate = *wcmChannelState(channel, 1);
 	int type = -1;
 
 	wcmRotateAndScaleCoordinates (priv->pInfo, &state.x, &state.y);
@@ -136,6 +136,8 @@ wcmSendTouchEvent(WacomDevicePtr priv, WacomChannelPtr channel, Bool no_update)
 	}
 
 	xf86PostTouchEvent(priv->pInfo->dev, state.serial_num - 1, type, 0, mask);
+	wcmStatAdd(priv->stats, STAT_POSTED, 1);
+	wcmRecordLatency(priv, state.time_us);
 #endif
 }
 
@@ -162,9 +164,9 @@ wcmFingerMultitouch(WacomDevicePtr priv, int contact_id) {
 		wcmSendButtonClick(priv, 1, 0);
 	}
 
-	for (i = 0; i < MAX_CHANNELS; i++) {
+	for (i = 0; i < priv->common->wcmChannelCnt; i++) {
 		WacomChannelPtr channel = priv->common->wcmChannel+i;
-		WacomDeviceState state  = channel->valid.state;
+		WacomDeviceState state  = *wcmChannelState(channel, 0);
 		if (state.device_type != TOUCH_ID)
 			continue;
 
@@ -248,7 +250,7 @@ static void wcmSendButtonClick(WacomDevicePtr priv, int button, int state)
  *   translate second finger tap to right click
  ****************************************************************************/
 
-static void wcmFingerTapToClick(WacomDevicePtr priv)
+static void wcmFingerTapToClick(WacomDevicePtr priv, CARD32 ms)
 {
 	WacomCommonPtr common = priv->common;
 	WacomDeviceState ds[2] = {}, dsLast[2] = {};
@@ -263,8 +265,7 @@ static void wcmFingerTapToClick(WacomDevicePtr priv)
 
 	/* process second finger tap if matched */
 	if ((ds[0].sample < ds[1].sample) &&
-	    ((GetTimeInMillis() -
-	    dsLast[1].sample) <= common->wcmGestureParameters.wcmTapTime) &&
+	    ((ms - dsLast[1].sample) <= common->wcmGestureParameters.wcmTapTime) &&
 	    !ds[1].proximity && dsLast[1].proximity)
 	{
 		/* send left up before sending right down */
@@ -351,8 +352,8 @@ static void wcmSingleFingerPress(WacomDevicePtr priv)
 	WacomCommonPtr common = priv->common;
 	WacomChannelPtr firstChannel = getContactNumber(common, 0);
 	WacomChannelPtr secondChannel = getContactNumber(common, 1);
-	Bool firstInProx = firstChannel && firstChannel->valid.states[0].proximity;
-	Bool secondInProx = secondChannel && secondChannel->valid.states[0].proximity;
+	Bool firstInProx = firstChannel && wcmChannelState(firstChannel, 0)->proximity;
+	Bool secondInProx = secondChannel && wcmChannelState(secondChannel, 0)->proximity;
 
 	DBG(10, priv, "\n");
 
@@ -361,11 +362,11 @@ static void wcmSingleFingerPress(WacomDevicePtr priv)
 		return;
 
 	if (firstInProx && !secondInProx) {
-		firstChannel->valid.states[0].buttons |= 1;
+		wcmChannelState(firstChannel, 0)->buttons |= 1;
 		common->wcmGestureMode = GESTURE_DRAG_MODE;
 	}
 	else {
-		firstChannel->valid.states[0].buttons &= ~1;
+		wcmChannelState(firstChannel, 0)->buttons &= ~1;
 		common->wcmGestureMode = GESTURE_NONE_MODE;
 	}
 }
@@ -388,8 +389,9 @@ void wcmCancelGesture(InputInfoPtr pInfo)
 	common->wcmGestureMode = GESTURE_CANCEL_MODE;
 }
 
-/* parsing gesture mode according to 2FGT data */
-void wcmGestureFilter(WacomDevicePtr priv, int touch_id)
+/* parsing gesture mode according to 2FGT data. ms is the timestamp of the
+ * event being processed. */
+void wcmGestureFilter(WacomDevicePtr priv, int touch_id, CARD32 ms)
 {
 	WacomCommonPtr common = priv->common;
 	WacomDeviceState ds[2] = {}, dsLast[2] = {};
@@ -446,8 +448,6 @@ void wcmGestureFilter(WacomDevicePtr priv, int touch_id)
 	 */
 	else if (dsLast[0].proximity && common->wcmGestureMode != GESTURE_DRAG_MODE)
 	{
-		CARD32 ms = GetTimeInMillis();
-
 		if ((ms - ds[0].sample) < WACOM_GESTURE_LAG_TIME)
 		{
 			/* Must have recently come into proximity.  Change
@@ -515,7 +515,7 @@ void wcmGestureFilter(WacomDevicePtr priv, int touch_id)
 	}
 
 	if (!(common->wcmGestureMode & (GESTURE_SCROLL_MODE | GESTURE_ZOOM_MODE)) && touch_id == 1)
-		wcmFingerTapToClick(priv);
+		wcmFingerTapToClick(priv, ms);
 
 	/* Change mode happens only when both fingers are out */
 	if (common->wcmGestureMode & GESTURE_TAP_MODE)
@@ -536,7 +536,6 @@ void wcmGestureFilter(WacomDevicePtr priv, int touch_id)
 
 	/* process complex two finger gestures */
 	else {
-		CARD32 ms = GetTimeInMillis();
 		int taptime = common->wcmGestureParameters.wcmTapTime;
 
 		if (ds[0].proximity && ds[1].proximity &&
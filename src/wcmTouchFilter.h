@@ -24,7 +24,7 @@
 
 /****************************************************************************/
 
-void wcmGestureFilter(WacomDevicePtr priv, int touch_id);
+void wcmGestureFilter(WacomDevicePtr priv, int touch_id, CARD32 ms);
 Bool wcmTouchNeedSendEvents(WacomCommonPtr common);
 
 /****************************************************************************/
@@ -0,0 +1,122 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "xf86Wacom.h"
+#include "wcmTrace.h"
+
+static const char *tracepointNames[TP_COUNT] = {
+	[TP_EVENT] = "event",
+	[TP_EVENT_AXES] = "event-axes",
+	[TP_EVENT_NO_TOOL] = "event-no-tool",
+	[TP_USB_EVENT] = "usb-event",
+	[TP_SEND] = "send",
+	[TP_SEND_AXES] = "send-axes",
+	[TP_SUPPRESS] = "suppress",
+};
+
+const char *wcmTracepointName(enum WacomTracepoint tp)
+{
+	if (tp < 0 || tp >= TP_COUNT)
+		return "unknown";
+	return tracepointNames[tp];
+}
+
+/**
+ * Record a tracepoint in the tablet's trace ring, overwriting the oldest
+ * record once the ring is full. Called from the input path through
+ * TRACE(), only while the tracepoint's category is enabled.
+ */
+void wcmTrace(WacomCommonPtr common, enum WacomTracepoint tp,
+	      int a, int b, int c, int d, int e)
+{
+	WacomTraceRecord *rec;
+
+	rec = &common->wcmTraceRing[common->wcmTraceHead++ & (TRACE_RING_SIZE - 1)];
+	rec->time_us = wcmTimeUs();
+	rec->tracepoint = tp;
+	rec->args[0] = a;
+	rec->args[1] = b;
+	rec->args[2] = c;
+	rec->args[3] = d;
+	rec->args[4] = e;
+}
+
+/**
+ * Enable the given tracepoint categories on this tablet. Categories that
+ * were not compiled in are ignored. The ring is allocated the first time
+ * a category is enabled and stays around until the common is freed.
+ *
+ * @return FALSE if the ring could not be allocated
+ */
+Bool wcmSetTraceMask(WacomCommonPtr common, int mask)
+{
+	mask &= WCM_TRACE_CATEGORIES;
+
+	if (mask && !common->wcmTraceRing)
+	{
+		common->wcmTraceRing = calloc(TRACE_RING_SIZE,
+					      sizeof(*common->wcmTraceRing));
+		if (!common->wcmTraceRing)
+			return FALSE;
+	}
+
+	/* the ring must exist before the input path sees the mask */
+	common->wcmTraceMask = mask;
+	return TRUE;
+}
+
+/**
+ * Format the records collected since the last dump into the log. This is
+ * the only place records are formatted, it must not be called from the
+ * input path.
+ */
+void wcmTraceDump(WacomCommonPtr common)
+{
+	unsigned int head = common->wcmTraceHead;
+	unsigned int i = common->wcmTraceDumped;
+
+	if (!common->wcmTraceRing || i == head)
+		return;
+
+	if (head - i > TRACE_RING_SIZE)
+	{
+		xf86Msg(X_INFO, "%s: trace: %u records lost\n",
+			common->device_path, head - i - TRACE_RING_SIZE);
+		i = head - TRACE_RING_SIZE;
+	}
+
+	for (; i != head; i++)
+	{
+		const WacomTraceRecord *rec =
+			&common->wcmTraceRing[i & (TRACE_RING_SIZE - 1)];
+
+		xf86Msg(X_INFO, "%s: trace: %llu.%06llu %-13s %d %d %d %d %d\n",
+			common->device_path,
+			(unsigned long long)(rec->time_us / 1000000),
+			(unsigned long long)(rec->time_us % 1000000),
+			wcmTracepointName(rec->tracepoint),
+			rec->args[0], rec->args[1], rec->args[2],
+			rec->args[3], rec->args[4]);
+	}
+
+	common->wcmTraceDumped = head;
+}
+
+/* vim: set noexpandtab tabstop=8 shiftwidth=8: */
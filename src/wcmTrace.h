@@ -0,0 +1,85 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __XF86_WCMTRACE_H
+#define __XF86_WCMTRACE_H
+
+#include "xf86Wacom.h"
+
+/******************************************************************************
+ * Tracepoints
+ *
+ * The hot path records fixed-size binary records into a per-tablet ring
+ * instead of formatting log messages. Records are only formatted when the
+ * ring is dumped to the log, see wcmTraceDump.
+ *****************************************************************************/
+
+/* Tracepoint categories, enabled at runtime with the "Trace" option or
+ * the Wacom Trace property */
+#define TRACE_EVENT	0x01	/* wcmEvent */
+#define TRACE_USB	0x02	/* usbDispatchEvents */
+#define TRACE_SEND	0x04	/* wcmSendEvents */
+#define TRACE_SUPPRESS	0x08	/* wcmCheckSuppress */
+#define TRACE_ALL	0x0f
+
+/* Categories compiled into the driver. Tracepoints of the others are
+ * compiled out completely. */
+#ifndef WCM_TRACE_CATEGORIES
+#ifdef WCM_TRACING
+#define WCM_TRACE_CATEGORIES TRACE_ALL
+#else
+#define WCM_TRACE_CATEGORIES 0
+#endif
+#endif
+
+#define TRACE_RING_SIZE 4096	/* records per tablet, power of two */
+
+enum WacomTracepoint {
+	TP_EVENT,		/* channel, device_type, serial, x, y */
+	TP_EVENT_AXES,		/* pressure, buttons, proximity, tiltx, tilty */
+	TP_EVENT_NO_TOOL,	/* channel, device_type, serial */
+	TP_USB_EVENT,		/* channel, type, code, value, handler */
+	TP_SEND,		/* proximity, x, y, z, buttons */
+	TP_SEND_AXES,		/* v3, v4, v5, v6, serial */
+	TP_SUPPRESS,		/* device_type, level, result */
+	TP_COUNT
+};
+
+#define TRACE_ARGS 5
+
+typedef struct _WacomTraceRecord {
+	uint64_t time_us;
+	int32_t tracepoint;	/* enum WacomTracepoint */
+	int32_t args[TRACE_ARGS];
+} WacomTraceRecord;
+
+#define TRACE(cat, common, tp, a, b, c, d, e) \
+	do { \
+		if ((WCM_TRACE_CATEGORIES & (cat)) && \
+		    ((common)->wcmTraceMask & (cat))) \
+			wcmTrace(common, tp, a, b, c, d, e); \
+	} while (0)
+
+/****************************************************************************/
+
+void wcmTrace(WacomCommonPtr common, enum WacomTracepoint tp,
+	      int a, int b, int c, int d, int e);
+Bool wcmSetTraceMask(WacomCommonPtr common, int mask);
+void wcmTraceDump(WacomCommonPtr common);
+const char *wcmTracepointName(enum WacomTracepoint tp);
+
+/****************************************************************************/
+#endif /* __XF86_WCMTRACE_H */
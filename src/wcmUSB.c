@@ -22,13 +22,43 @@
 #endif
 
 #include "xf86Wacom.h"
+#include "wcmTrace.h"
 
 #include <asm/types.h>
 #include <linux/input.h>
 #include <sys/utsname.h>
+#include <time.h>
 #include <linux/version.h>
 
-#define MAX_USB_EVENTS 32
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+/* Kernel timestamp of an event in microseconds */
+#define usbEventTime(ev) \
+	((uint64_t)(ev)->input_event_sec * 1000000 + (ev)->input_event_usec)
+
+#define MAX_USB_EVENTS 32	/* initial event queue size and headroom */
+#define USB_TOOL_HASH_SIZE 16	/* power of two */
+#define USB_SLOT_MAP_SIZE 64	/* slots past this go through the hash */
+#define USB_EVENTS_LIMIT 4096	/* max event queue size */
+
+#ifndef SYN_DROPPED
+#define SYN_DROPPED 3
+#endif
+
+/* Event handlers, indexes into usbEventHandlers[] */
+enum {
+	USB_EVENT_DROP = 0,	/* filtered or nothing to do */
+	USB_EVENT_ABS,		/* usbParseAbsEvent */
+	USB_EVENT_ABS_MT,	/* usbParseAbsMTEvent */
+	USB_EVENT_KEY,		/* usbParseKeyEvent */
+	USB_EVENT_BTN,		/* usbParseBTNEvent */
+	USB_EVENT_WHEEL,	/* usbParseWheelEvent */
+	USB_EVENT_REL,		/* usbParseRelEvent */
+	USB_EVENT_SW,		/* usbParseSwitchEvent */
+};
 
 typedef struct {
 	int wcmLastToolSerial;
@@ -36,12 +66,27 @@ typedef struct {
 	Bool wcmPenTouch;
 	Bool wcmUseMT;
 	int wcmMTChannel;
-	int wcmEventCnt;
-	struct input_event wcmEvents[MAX_USB_EVENTS];
 	int nbuttons;                /* total number of buttons */
 	int npadkeys;                /* number of pad keys in the above array */
 	int padkey_code[WCM_MAX_BUTTONS];/* hardware codes for buttons */
 	int lastChannel;
+	/* channel lookup, see usbChooseChannel. Entries are channel + 1, 0 if none */
+	unsigned short wcmSlotChannel[USB_SLOT_MAP_SIZE]; /* MT slot -> channel */
+	unsigned short wcmToolChannel[USB_TOOL_HASH_SIZE]; /* (type, serial) -> channel */
+	unsigned long wcmAbs[NBITS(ABS_MAX)]; /* supported absolute axes */
+	unsigned long wcmKeyState[NBITS(KEY_MAX)]; /* shadow of EVIOCGKEY */
+	int wcmAbsState[ABS_MT_SLOT]; /* shadow of the EVIOCGABS values */
+	Bool wcmSynDropped;          /* discarding events up to the next SYN_REPORT */
+	Bool wcmEventMapReady;       /* maps and shadow state built, see usbWcmGetRanges */
+	unsigned int wcmResyncs;     /* state rebuilds after SYN_DROPPED */
+	/* (type, code) -> USB_EVENT_* handler, built by usbInitEventMap */
+	unsigned char wcmKeyMap[KEY_CNT];
+	unsigned char wcmAbsMap[2][ABS_CNT]; /* [1] for touch frames */
+	unsigned char wcmRelMap[REL_CNT];
+	unsigned char wcmSwMap[SW_CNT];
+	int wcmEventCnt;
+	int wcmEventSize;            /* allocated size of wcmEvents */
+	struct input_event wcmEvents[]; /* must be last */
 } wcmUSBData;
 
 static Bool usbDetect(InputInfoPtr);
@@ -59,8 +104,18 @@ static void usbParseEvent(InputInfoPtr pInfo,
 	const struct input_event* event);
 static void usbParseSynEvent(InputInfoPtr pInfo,
 			     const struct input_event *event);
-static void usbDispatchEvents(InputInfoPtr pInfo);
+static void usbDispatchFrame(InputInfoPtr pInfo,
+			     const struct input_event *events, int nevents);
+static void usbParseFrame(InputInfoPtr pInfo,
+			  const struct input_event *events, int nevents);
+static void usbDispatchEvents(InputInfoPtr pInfo,
+			      const struct input_event *events, int nevents);
 static int usbChooseChannel(WacomCommonPtr common, int device_type, unsigned int serial);
+static wcmUSBData* usbResizeEventQueue(WacomCommonPtr common, int size);
+static int usbFetchState(InputInfoPtr pInfo);
+static void usbSynDropped(InputInfoPtr pInfo);
+static void usbResync(InputInfoPtr pInfo);
+static void usbInitEventMap(WacomCommonPtr common);
 
 	WacomDeviceClass gWacomUSBDevice =
 	{
@@ -136,7 +191,26 @@ static Bool usbDetect(InputInfoPtr pInfo)
 static int
 usbStart(InputInfoPtr pInfo)
 {
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
 	int err;
+#ifdef EVIOCSCLOCKID
+	int clk = CLOCK_MONOTONIC;
+
+	/* timestamp events on the same clock as wcmTimeUs() */
+	SYSCALL(err = ioctl(pInfo->fd, EVIOCSCLOCKID, &clk));
+	if (err < 0)
+		xf86Msg(X_WARNING, "%s: unable to use monotonic event timestamps (%s)\n",
+			pInfo->name, strerror(errno));
+#endif
+
+	/* The shadow state is shared by all tools on the fd. If this tool
+	 * just opened it, nobody else is dispatching its events and the
+	 * events since the state was seeded are gone with the old fd.
+	 * Server managed fds don't count references. */
+	if (common->fd_refs == 1 && usbFetchState(pInfo) != Success)
+		xf86Msg(X_WARNING, "%s: unable to fetch the initial key state\n",
+			pInfo->name);
 
 	if (xf86CheckBoolOption(pInfo->options, "GrabDevice", 0))
 	{
@@ -402,7 +476,7 @@ static Bool usbWcmInit(InputInfoPtr pInfo, char* id, size_t id_len, float *versi
 	DBG(1, priv, "initializing USB tablet\n");
 
 	if (!common->private &&
-	    !(common->private = calloc(1, sizeof(wcmUSBData))))
+	    !usbResizeEventQueue(common, MAX_USB_EVENTS))
 	{
 		xf86Msg(X_ERROR, "%s: unable to alloc event queue.\n",
 					pInfo->name);
@@ -507,7 +581,7 @@ static void usbWcmInitPadState(InputInfoPtr pInfo)
 	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
 	WacomCommonPtr common = priv->common;
 	WacomDeviceState *ds;
-	int channel = PAD_CHANNEL;
+	int channel = PAD_CHANNEL(common);
 
 	DBG(6, common, "Initializing PAD channel %d\n", channel);
 
@@ -517,9 +591,63 @@ static void usbWcmInitPadState(InputInfoPtr pInfo)
 	ds->device_type = PAD_ID;
 	ds->device_id = PAD_DEVICE_ID;
 	ds->serial_num = channel;
+
+	SETBIT(common->wcmBusyChannels, channel);
 }
 
-int usbWcmGetRanges(InputInfoPtr pInfo)
+/**
+ * Resize the event queue at the end of the USB private data, allocating
+ * the private data if there is none yet. The queue never shrinks below
+ * the events it currently holds.
+ *
+ * @return The new private data or NULL if the allocation failed, in which
+ * case the old data is left untouched.
+ */
+static wcmUSBData* usbResizeEventQueue(WacomCommonPtr common, int size)
+{
+	wcmUSBData *private = common->private;
+	int old_size = private ? private->wcmEventSize : 0;
+
+	if (private && size < private->wcmEventCnt)
+		size = private->wcmEventCnt;
+
+	private = realloc(private, sizeof(wcmUSBData) +
+			  size * sizeof(struct input_event));
+	if (!private)
+		return NULL;
+
+	if (!common->private)
+		memset(private, 0, sizeof(wcmUSBData));
+	else if (size > old_size)
+		memset(&private->wcmEvents[old_size], 0,
+		       (size - old_size) * sizeof(struct input_event));
+	private->wcmEventSize = size;
+	common->private = private;
+
+	return private;
+}
+
+/**
+ * Worst case number of events in a frame: every axis, a slot change
+ * plus all MT axes for every contact, and MAX_USB_EVENTS for keys,
+ * MSC_SERIAL and SYN_REPORT.
+ */
+TEST_NON_STATIC int usbEventQueueSize(const unsigned long *abs, int contacts)
+{
+	int i, naxes = 0, nmtaxes = 0;
+
+	for (i = 0; i < ABS_MT_SLOT; i++)
+		if (ISBITSET(abs, i))
+			naxes++;
+	for (i = ABS_MT_SLOT + 1; i <= ABS_MAX; i++)
+		if (ISBITSET(abs, i))
+			nmtaxes++;
+
+	return min(MAX_USB_EVENTS + naxes + contacts * (1 + nmtaxes),
+		   USB_EVENTS_LIMIT);
+}
+
+static int usbGetRanges(InputInfoPtr pInfo)
 {
 	struct input_absinfo absinfo;
 	unsigned long ev[NBITS(EV_MAX)] = {0};
@@ -529,6 +657,7 @@ int usbWcmGetRanges(InputInfoPtr pInfo)
 	WacomCommonPtr common =	priv->common;
 	wcmUSBData* private = common->private;
 	int is_touch = IsTouch(priv);
+	int size;
 
 	/* Devices such as Bamboo P&T may have Pad data reported in the same
 	 * packet as Touch.  It's normal for Pad to be called first but logic
@@ -561,6 +690,7 @@ int usbWcmGetRanges(InputInfoPtr pInfo)
 		xf86Msg(X_ERROR, "%s: unable to ioctl max values.\n", pInfo->name);
 		return !Success;
 	}
+	memcpy(private->wcmAbs, abs, sizeof(private->wcmAbs));
 
 	/* max x */
 	if (ioctl(pInfo->fd, EVIOCGABS(ABS_X), &absinfo) < 0)
@@ -763,6 +893,27 @@ int usbWcmGetRanges(InputInfoPtr pInfo)
 	if (!ISBITSET(abs, ABS_MISC))
 		common->wcmProtocolLevel = WCM_PROTOCOL_GENERIC;
 
+	if (!wcmAllocChannels(common, private->wcmUseMT ? common->wcmMaxContacts : 0))
+	{
+		xf86Msg(X_ERROR, "%s: unable to allocate channels for %d contacts.\n",
+			pInfo->name, common->wcmMaxContacts);
+		return !Success;
+	}
+
+	size = usbEventQueueSize(abs, private->wcmUseMT ? common->wcmMaxContacts : 0);
+	if (size > private->wcmEventSize)
+	{
+		/* a failed resize leaves common->private alone */
+		if (!usbResizeEventQueue(common, size))
+		{
+			xf86Msg(X_ERROR, "%s: unable to grow event queue to %d.\n",
+				pInfo->name, size);
+			return !Success;
+		}
+		private = common->private;
+		DBG(3, common, "event queue size %d\n", size);
+	}
+
 	if (ioctl(pInfo->fd, EVIOCGBIT(EV_SW, sizeof(sw)), sw) < 0)
 	{
 		xf86Msg(X_ERROR, "%s: unable to ioctl sw bits.\n", pInfo->name);
@@ -787,6 +938,31 @@ int usbWcmGetRanges(InputInfoPtr pInfo)
 	return Success;
 }
 
+int usbWcmGetRanges(InputInfoPtr pInfo)
+{
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common =	priv->common;
+	wcmUSBData* private;
+
+	if (usbGetRanges(pInfo) != Success)
+		return !Success;
+
+	/* The event maps and the key and axis state are shared by all tools
+	 * on the fd. Tools that are already enabled keep dispatching while
+	 * another one is added, so both are only built for the first tool. */
+	private = common->private;
+	if (!private->wcmEventMapReady)
+	{
+		usbInitEventMap(common);
+		if (usbFetchState(pInfo) != Success)
+			xf86Msg(X_WARNING, "%s: unable to fetch the initial key state\n",
+				pInfo->name);
+		private->wcmEventMapReady = TRUE;
+	}
+
+	return Success;
+}
+
 static int usbDetectConfig(InputInfoPtr pInfo)
 {
 	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
@@ -805,15 +981,71 @@ static int usbDetectConfig(InputInfoPtr pInfo)
 	return TRUE;
 }
 
+/**
+ * Parse the events in the reception buffer. A complete frame, i.e. all
+ * events up to and including the SYN_REPORT, is dispatched in place. An
+ * incomplete frame is left in the buffer until the rest of it arrives.
+ *
+ * Frames that don't fit into the reception ring, and the remainder of a
+ * frame once it started being queued, are copied into wcmEvents one event
+ * at a time instead.
+ *
+ * After a SYN_DROPPED everything up to the next SYN_REPORT is discarded
+ * and the state is rebuilt from the kernel, see usbResync.
+ */
 static int usbParse(InputInfoPtr pInfo, const unsigned char* data, int len)
 {
 	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
 	WacomCommonPtr common = priv->common;
+	wcmUSBData* private = common->private;
+	const struct input_event *events = (const struct input_event*)data;
+	int i, nevents = len / sizeof(struct input_event);
 
-	if (len < sizeof(struct input_event))
+	if (nevents < 1)
 		return 0;
 
-	usbParseEvent(pInfo, (const struct input_event*)data);
+	if (private->wcmSynDropped)
+	{
+		for (i = 0; i < nevents; i++)
+		{
+			if (events[i].type == EV_SYN && events[i].code == SYN_REPORT)
+			{
+				private->wcmSynDropped = FALSE;
+				usbResync(pInfo);
+				return (i + 1) * sizeof(struct input_event);
+			}
+		}
+
+		return nevents * sizeof(struct input_event);
+	}
+
+	if (private->wcmEventCnt == 0)
+	{
+		for (i = 0; i < nevents; i++)
+		{
+			if (events[i].type != EV_SYN)
+				continue;
+
+			if (events[i].code == SYN_REPORT)
+			{
+				usbParseFrame(pInfo, events, i + 1);
+				return (i + 1) * sizeof(struct input_event);
+			}
+			else if (events[i].code == SYN_DROPPED)
+			{
+				usbSynDropped(pInfo);
+				return (i + 1) * sizeof(struct input_event);
+			}
+		}
+
+		/* wait for the SYN_REPORT unless the ring is full */
+		if (len < RING_SIZE)
+			return 0;
+
+		DBG(1, common, "frame exceeds %d bytes, queueing\n", len);
+	}
+
+	usbParseEvent(pInfo, events);
 	return common->wcmPktLength;
 }
 
@@ -850,13 +1082,125 @@ static int protocol5Serial(int device_type, unsigned int serial) {
 	}
 }
 
+/**
+ * @return The first bit set in mask at or after from, or nbits if none.
+ */
+TEST_NON_STATIC int usbNextBit(const unsigned long *mask, int nbits, int from)
+{
+	int i = LONG(from);
+	unsigned long word;
+
+	if (from >= nbits)
+		return nbits;
+
+	word = mask[i] & (~0UL << OFF(from));
+	while (!word)
+	{
+		if (++i >= NBITS(nbits))
+			return nbits;
+		word = mask[i];
+	}
+
+	return min(i * (int)BITS_PER_LONG + __builtin_ctzl(word), nbits);
+}
+
+/**
+ * @return The first bit clear in mask, or nbits if none.
+ */
+TEST_NON_STATIC int usbFirstClearBit(const unsigned long *mask, int nbits)
+{
+	int i;
+
+	for (i = 0; i < NBITS(nbits); i++)
+		if (~mask[i])
+			return min(i * (int)BITS_PER_LONG + __builtin_ctzl(~mask[i]), nbits);
+
+	return nbits;
+}
+
+static inline Bool usbChannelMatches(const WacomChannel *channel,
+				     int device_type, unsigned int serial)
+{
+	return channel->work.proximity &&
+	       channel->work.device_type == device_type &&
+	       channel->work.serial_num == serial;
+}
+
+static inline void usbMarkDirty(WacomCommonPtr common, int channel, int change)
+{
+	common->wcmDirtyChannels[LONG(channel)] |= (unsigned long)!!change << OFF(channel);
+}
+
+/**
+ * @return The index entry for a tool: MT contacts are looked up by slot
+ * (serial - 1), everything else through a small hash.
+ */
+static unsigned short* usbChannelIndex(wcmUSBData *private,
+				       int device_type, unsigned int serial)
+{
+	if (device_type == TOUCH_ID &&
+	    serial - 1 < ARRAY_SIZE(private->wcmSlotChannel))
+		return &private->wcmSlotChannel[serial - 1];
+
+	return &private->wcmToolChannel[(serial ^ (serial >> 8) ^ device_type) &
+					(USB_TOOL_HASH_SIZE - 1)];
+}
+
+/**
+ * Take the lowest channel that isn't busy and mark it busy. Channels only
+ * stop being busy in usbReleaseChannel, so once they have all been handed
+ * out, take back those that have left proximity since.
+ *
+ * @return The channel or -1 if all channels are in proximity.
+ */
+static int usbTakeFreeChannel(WacomCommonPtr common)
+{
+	unsigned long *busy = common->wcmBusyChannels;
+	int nchannels = common->wcmChannelCnt;
+	int i;
+
+	SETBIT(busy, PAD_CHANNEL(common));
+
+	while ((i = usbFirstClearBit(busy, nchannels)) < nchannels)
+	{
+		SETBIT(busy, i);
+		/* slot 0 of a MT device may start without an ABS_MT_SLOT */
+		if (!common->wcmChannel[i].work.proximity)
+			return i;
+	}
+
+	for (i = 0; i < nchannels; i++)
+	{
+		if (i != PAD_CHANNEL(common) && !common->wcmChannel[i].work.proximity)
+			CLEARBIT(busy, i);
+	}
+
+	i = usbFirstClearBit(busy, nchannels);
+	if (i == nchannels)
+		return -1;
+
+	SETBIT(busy, i);
+	return i;
+}
+
+/* Give a channel back to usbTakeFreeChannel once it has left proximity */
+static inline void usbReleaseChannel(WacomCommonPtr common, int channel)
+{
+	if (channel != PAD_CHANNEL(common) && !common->wcmChannel[channel].work.proximity)
+		CLEARBIT(common->wcmBusyChannels, channel);
+}
+
 /**
  * Find an appropriate channel to track the specified tool's state in.
  * If the tool is already in proximity, the channel currently being used
  * to store its state will be returned. Otherwise, an arbitrary available
- * channel will be cleaned and returned. Up to MAX_CHANNEL tools can be
+ * channel will be cleaned and returned. Up to wcmChannelCnt tools can be
  * tracked concurrently by driver.
  *
+ * Tools are found through the slot and hash index in wcmUSBData, the index
+ * is only a hint and checked against the channel's state. On a miss only
+ * the busy channels are searched.
+ *
  * @param[in] common
  * @param[in] device_type  Type of tool (e.g. STYLUS_ID, TOUCH_ID, PAD_ID)
  * @param[in] serial       Serial number of tool
@@ -864,42 +1208,40 @@ static int protocol5Serial(int device_type, unsigned int serial) {
  */
 static int usbChooseChannel(WacomCommonPtr common, int device_type, unsigned int serial)
 {
+	wcmUSBData* private = common->private;
+	unsigned short *index;
 	/* figure out the channel to use based on serial number */
 	int i, channel = -1;
 
 	/* force events from PAD device to PAD_CHANNEL */
 	if (serial == -1)
-		channel = PAD_CHANNEL;
+		return PAD_CHANNEL(common);
 
 	/* find existing channel */
-	if (channel < 0)
+	index = usbChannelIndex(private, device_type, serial);
+	if (*index && usbChannelMatches(&common->wcmChannel[*index - 1],
+					device_type, serial))
+		return *index - 1;
+
+	for (i = usbNextBit(common->wcmBusyChannels, common->wcmChannelCnt, 0);
+	     i < common->wcmChannelCnt;
+	     i = usbNextBit(common->wcmBusyChannels, common->wcmChannelCnt, i + 1))
 	{
-		for (i=0; i<MAX_CHANNELS; i++)
+		if (usbChannelMatches(&common->wcmChannel[i], device_type, serial))
 		{
-			if (common->wcmChannel[i].work.proximity &&
-			    common->wcmChannel[i].work.device_type == device_type &&
-			    common->wcmChannel[i].work.serial_num == serial)
-			{
-				channel = i;
-				break;
-			}
+			channel = i;
+			break;
 		}
 	}
 
 	/* find and clean an empty channel */
 	if (channel < 0)
 	{
-		for (i=0; i<MAX_CHANNELS; i++)
+		channel = usbTakeFreeChannel(common);
+		if (channel >= 0)
 		{
-			if (i == PAD_CHANNEL)
-				continue;
-
-			if (!common->wcmChannel[i].work.proximity)
-			{
-				channel = i;
-				memset(&common->wcmChannel[channel],0, sizeof(WacomChannel));
-				break;
-			}
+			memset(&common->wcmChannel[channel],0, sizeof(WacomChannel));
+			CLEARBIT(common->wcmDirtyChannels, channel);
 		}
 	}
 
@@ -909,9 +1251,9 @@ static int usbChooseChannel(WacomCommonPtr common, int device_type, unsigned int
 		/* This should never happen in normal use.
 		 * Let's start over again. Force prox-out for all channels.
 		 */
-		for (i=0; i<MAX_CHANNELS; i++)
+		for (i=0; i<common->wcmChannelCnt; i++)
 		{
-			if (i == PAD_CHANNEL)
+			if (i == PAD_CHANNEL(common))
 				continue;
 
 			if (common->wcmChannel[i].work.proximity &&
@@ -920,6 +1262,7 @@ static int usbChooseChannel(WacomCommonPtr common, int device_type, unsigned int
 				common->wcmChannel[i].work.proximity = 0;
 				/* dispatch event */
 				wcmEvent(common, i, &common->wcmChannel[i].work);
+				usbReleaseChannel(common, i);
 				DBG(2, common, "free channels: dropping %u\n",
 						common->wcmChannel[i].work.serial_num);
 			}
@@ -927,11 +1270,30 @@ static int usbChooseChannel(WacomCommonPtr common, int device_type, unsigned int
 		DBG(1, common, "device with serial number: %u"
 		    " at %d: Exceeded channel count; ignoring the events.\n",
 		    serial, (int)GetTimeInMillis());
+		common->wcmStats[STAT_CHANNEL_EXHAUSTED]++;
+		return -1;
 	}
 
+	*index = channel + 1;
 	return channel;
 }
 
+/* Track the key and axis state the kernel reports through EVIOCGKEY and
+ * EVIOCGABS, so dispatch doesn't have to ask for it. */
+static inline void usbUpdateState(wcmUSBData *private,
+				  const struct input_event *event)
+{
+	if (event->type == EV_KEY && event->code <= KEY_MAX)
+	{
+		if (event->value)
+			SETBIT(private->wcmKeyState, event->code);
+		else
+			CLEARBIT(private->wcmKeyState, event->code);
+	}
+	else if (event->type == EV_ABS && event->code < ABS_MT_SLOT)
+		private->wcmAbsState[event->code] = event->value;
+}
+
 static void usbParseEvent(InputInfoPtr pInfo,
 	const struct input_event* event)
 {
@@ -941,17 +1303,37 @@ static void usbParseEvent(InputInfoPtr pInfo,
 
 	DBG(10, common, "\n");
 
+	usbUpdateState(private, event);
+
 	/* store events until we receive the MSC_SERIAL containing
 	 * the serial number or a SYN_REPORT.
 	 */
 
-	/* space left? bail if not. */
-	if (private->wcmEventCnt >= ARRAY_SIZE(private->wcmEvents))
+	/* space left? grow or split the frame if not. */
+	if (private->wcmEventCnt >= private->wcmEventSize)
 	{
-		LogMessageVerbSigSafe(X_ERROR, 0, "%s: usbParse: Exceeded event queue (%d) \n",
-				      pInfo->name, private->wcmEventCnt);
-		private->wcmEventCnt = 0;
-		return;
+		wcmUSBData *grown = NULL;
+
+		common->wcmStats[STAT_QUEUE_OVERFLOW]++;
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 23
+		/* we're on the input thread, not in a signal handler */
+		if (private->wcmEventSize < USB_EVENTS_LIMIT)
+			grown = usbResizeEventQueue(common,
+					min(private->wcmEventSize * 2, USB_EVENTS_LIMIT));
+#endif
+		if (grown)
+		{
+			private = grown;
+			DBG(1, common, "Exceeded event queue (%d), grown to %d\n",
+			    private->wcmEventCnt, private->wcmEventSize);
+		} else
+		{
+			wcmLogDeferred(common, LOG_EVENT_QUEUE_EXCEEDED,
+				       private->wcmEventCnt,
+				       common->wcmStats[STAT_QUEUE_OVERFLOW], 0);
+			usbDispatchFrame(pInfo, private->wcmEvents, private->wcmEventCnt);
+			private->wcmEventCnt = 0;
+		}
 	}
 
 	/* save it for later */
@@ -980,9 +1362,7 @@ static void usbParseSynEvent(InputInfoPtr pInfo,
 		 * but we never report a serial number with a value of 0 */
 		if (event->value == 0)
 		{
-			LogMessageVerbSigSafe(X_ERROR, 0,
-					      "%s: usbParse: Ignoring event from invalid serial 0\n",
-					      pInfo->name);
+			wcmLogDeferred(common, LOG_INVALID_SERIAL, 0, 0, 0);
 			goto skipEvent;
 		}
 
@@ -995,82 +1375,157 @@ static void usbParseSynEvent(InputInfoPtr pInfo,
 	{
 		/* end of record. fall through to dispatch */
 	}
+	else if ((event->type == EV_SYN) && (event->code == SYN_DROPPED))
+	{
+		/* the queued events are incomplete, drop them */
+		usbSynDropped(pInfo);
+		goto skipEvent;
+	}
 	else
 	{
 		/* not an SYN_REPORT and not an SYN_REPORT, bail out */
 		return;
 	}
 
+	/* dispatch all queued events */
+	usbDispatchFrame(pInfo, private->wcmEvents, private->wcmEventCnt);
+
+skipEvent:
+	private->wcmEventCnt = 0;
+}
+
+/**
+ * Check a complete frame for valid data and hand it over to dispatch.
+ */
+static void usbDispatchFrame(InputInfoPtr pInfo,
+			     const struct input_event *events, int nevents)
+{
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
+	wcmUSBData* private = common->private;
+
+	wcmStatAdd(common->wcmStats, STAT_FRAMES, 1);
+
 	/* ignore events without information */
-	if ((private->wcmEventCnt < 2) && private->wcmLastToolSerial)
+	if ((nevents < 2) && private->wcmLastToolSerial)
 	{
 		DBG(3, common, "%s: dropping empty event"
 			" for serial %d\n", pInfo->name,
 			private->wcmLastToolSerial);
-		goto skipEvent;
+		return;
 	}
 
 	/* ignore sync windows that contain no data */
-	if (private->wcmEventCnt == 1 &&
-	    private->wcmEvents->type == EV_SYN) {
+	if (nevents == 1 && events->type == EV_SYN) {
 		DBG(6, common, "no real events received\n");
-		goto skipEvent;
+		return;
 	}
 
-	/* dispatch all queued events */
-	usbDispatchEvents(pInfo);
+	usbDispatchEvents(pInfo, events, nevents);
+}
 
-skipEvent:
-	private->wcmEventCnt = 0;
+/**
+ * Parse a complete frame in place. This is the equivalent of queueing the
+ * frame's events with usbParseEvent, without the copy.
+ */
+static void usbParseFrame(InputInfoPtr pInfo,
+			  const struct input_event *events, int nevents)
+{
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
+	wcmUSBData* private = common->private;
+	int i;
+
+	for (i = 0; i < nevents; i++)
+	{
+		usbUpdateState(private, &events[i]);
+
+		if (events[i].type != EV_MSC || events[i].code != MSC_SERIAL)
+			continue;
+
+		if (events[i].value == 0)
+		{
+			wcmLogDeferred(common, LOG_INVALID_SERIAL, 0, 0, 0);
+			/* drop everything up to here, like a queue reset */
+			events += i + 1;
+			nevents -= i + 1;
+			i = -1;
+			continue;
+		}
+
+		/* save the serial number so we can look up the channel number later */
+		private->wcmLastToolSerial = events[i].value;
+	}
+
+	usbDispatchFrame(pInfo, events, nevents);
 }
 
-static int usbFilterEvent(WacomCommonPtr common, struct input_event *event)
+/**
+ * Build the (type, code) -> handler tables used by usbDispatchEvents. The
+ * filtering only depends on the protocol level, wcmUseMT and whether the
+ * frame belongs to touch, so it is done once here instead of per event.
+ */
+static void usbInitEventMap(WacomCommonPtr common)
 {
+	static const unsigned short abs_codes[] = {
+		ABS_X, ABS_Y, ABS_RX, ABS_RY, ABS_RZ, ABS_TILT_X, ABS_TILT_Y,
+		ABS_PRESSURE, ABS_DISTANCE, ABS_WHEEL, ABS_Z, ABS_THROTTLE,
+		ABS_MISC
+	};
+	static const unsigned short mt_codes[] = {
+		ABS_MT_SLOT, ABS_MT_TRACKING_ID, ABS_MT_POSITION_X,
+		ABS_MT_POSITION_Y, ABS_MT_PRESSURE
+	};
+	static const unsigned short key_codes[] = {
+		BTN_TOOL_PEN, BTN_TOOL_PENCIL, BTN_TOOL_BRUSH, BTN_TOOL_AIRBRUSH,
+		BTN_TOOL_RUBBER, BTN_TOOL_MOUSE, BTN_TOOL_LENS, BTN_TOUCH,
+		BTN_TOOL_FINGER, BTN_TOOL_DOUBLETAP, BTN_TOOL_TRIPLETAP,
+		BTN_STYLUS, BTN_STYLUS2
+	};
 	wcmUSBData* private = common->private;
+	int i, touch;
+
+	memset(private->wcmKeyMap, USB_EVENT_DROP, sizeof(private->wcmKeyMap));
+	memset(private->wcmAbsMap, USB_EVENT_DROP, sizeof(private->wcmAbsMap));
+	memset(private->wcmRelMap, USB_EVENT_REL, sizeof(private->wcmRelMap));
+	memset(private->wcmSwMap, USB_EVENT_DROP, sizeof(private->wcmSwMap));
+
+	/* Button events can be from puck or expresskeys */
+	for (i = 0; i < ARRAY_SIZE(mouse_codes); i++)
+		private->wcmKeyMap[mouse_codes[i]] = USB_EVENT_BTN;
+	/* pads that use the mouse buttons have no pad key codes */
+	for (i = 0; i < private->npadkeys; i++)
+		if (private->padkey_code[i])
+			private->wcmKeyMap[private->padkey_code[i]] = USB_EVENT_BTN;
+	for (i = 0; i < ARRAY_SIZE(key_codes); i++)
+		private->wcmKeyMap[key_codes[i]] = USB_EVENT_KEY;
+
+	for (touch = 0; touch < 2; touch++)
+	{
+		for (i = 0; i < ARRAY_SIZE(abs_codes); i++)
+			private->wcmAbsMap[touch][abs_codes[i]] = USB_EVENT_ABS;
+		for (i = 0; i < ARRAY_SIZE(mt_codes); i++)
+			private->wcmAbsMap[touch][mt_codes[i]] = USB_EVENT_ABS_MT;
+	}
 
 	/* For devices that report multitouch, the following list is a set of
 	 * duplicate data from one slot and needs to be filtered out.
 	 */
 	if (private->wcmUseMT)
 	{
-		if (event->type == EV_KEY)
-		{
-			switch(event->code)
-			{
-				case BTN_TOUCH:
-				case BTN_TOOL_FINGER:
-				case BTN_TOOL_DOUBLETAP:
-				case BTN_TOOL_TRIPLETAP:
-					return 1;
-			}
-		}
-		else if (event->type == EV_ABS)
-		{
-			if (private->wcmDeviceType == TOUCH_ID)
-			{
-				/* filter ST for MT */
-				switch(event->code)
-				{
-					case ABS_X:
-					case ABS_Y:
-					case ABS_PRESSURE:
-						return 1;
-				}
-			}
-			else
-			{
-				/* filter MT for pen */
-				switch(event->code)
-				{
-					case ABS_MT_SLOT:
-					case ABS_MT_TRACKING_ID:
-					case ABS_MT_POSITION_X:
-					case ABS_MT_POSITION_Y:
-					case ABS_MT_PRESSURE:
-						return 1;
-				}
-			}
-		}
+		private->wcmKeyMap[BTN_TOUCH] = USB_EVENT_DROP;
+		private->wcmKeyMap[BTN_TOOL_FINGER] = USB_EVENT_DROP;
+		private->wcmKeyMap[BTN_TOOL_DOUBLETAP] = USB_EVENT_DROP;
+		private->wcmKeyMap[BTN_TOOL_TRIPLETAP] = USB_EVENT_DROP;
+
+		/* filter ST for MT */
+		private->wcmAbsMap[1][ABS_X] = USB_EVENT_DROP;
+		private->wcmAbsMap[1][ABS_Y] = USB_EVENT_DROP;
+		private->wcmAbsMap[1][ABS_PRESSURE] = USB_EVENT_DROP;
+
+		/* filter MT for pen */
+		for (i = 0; i < ARRAY_SIZE(mt_codes); i++)
+			private->wcmAbsMap[0][mt_codes[i]] = USB_EVENT_DROP;
 	}
 
 	/* For generic devices, filter out doubletap/tripletap that
@@ -1078,18 +1533,46 @@ static int usbFilterEvent(WacomCommonPtr common, struct input_event *event)
 	 */
 	if (common->wcmProtocolLevel == WCM_PROTOCOL_GENERIC)
 	{
-		if (event->type == EV_KEY)
-		{
-			switch(event->code)
-			{
-				case BTN_TOOL_DOUBLETAP:
-				case BTN_TOOL_TRIPLETAP:
-					return 1;
-			}
-		}
+		private->wcmKeyMap[BTN_TOOL_DOUBLETAP] = USB_EVENT_DROP;
+		private->wcmKeyMap[BTN_TOOL_TRIPLETAP] = USB_EVENT_DROP;
 	}
 
-	return 0;
+	private->wcmRelMap[REL_WHEEL] = USB_EVENT_WHEEL;
+
+	if (common->wcmHasHWTouchSwitch)
+		private->wcmSwMap[SW_MUTE_DEVICE] = USB_EVENT_SW;
+}
+
+/**
+ * Look up the handler for an event.
+ *
+ * @param touch TRUE if the event is part of a touch frame
+ * @return One of USB_EVENT_*
+ */
+static inline int usbEventHandler(const wcmUSBData *private,
+				  const struct input_event *event, int touch)
+{
+	switch (event->type)
+	{
+		case EV_KEY:
+			if (event->code < KEY_CNT)
+				return private->wcmKeyMap[event->code];
+			break;
+		case EV_ABS:
+			if (event->code < ABS_CNT)
+				return private->wcmAbsMap[touch][event->code];
+			break;
+		case EV_REL:
+			if (event->code < REL_CNT)
+				return private->wcmRelMap[event->code];
+			break;
+		case EV_SW:
+			if (event->code < SW_CNT)
+				return private->wcmSwMap[event->code];
+			break;
+	}
+
+	return USB_EVENT_DROP;
 }
 
 #define ERASER_BIT      0x008
@@ -1149,10 +1632,9 @@ static int usbFindDeviceTypeById(int device_id)
 }
 
 static void usbParseAbsEvent(WacomCommonPtr common,
-			    struct input_event *event, int channel_number)
+			    const struct input_event *event, int channel_number)
 {
-	WacomChannel *channel = &common->wcmChannel[channel_number];
-	WacomDeviceState *ds = &channel->work;
+	WacomDeviceState *ds = &common->wcmChannel[channel_number].work;
 	int change = 1;
 
 	switch(event->code)
@@ -1209,8 +1691,8 @@ static void usbParseAbsEvent(WacomCommonPtr common,
 			change = 0;
 	}
 
-	ds->time = (int)GetTimeInMillis();
-	channel->dirty |= change;
+	wcmSetStateTime(ds, usbEventTime(event));
+	usbMarkDirty(common, channel_number, change);
 }
 
 /**
@@ -1245,7 +1727,9 @@ mod_buttons(int buttons, int btn, int state)
 	return buttons;
 }
 
-static void usbParseAbsMTEvent(WacomCommonPtr common, struct input_event *event)
+/* MT events go to the slot's channel, channel_number is ignored */
+static void usbParseAbsMTEvent(WacomCommonPtr common,
+			       const struct input_event *event, int channel_number)
 {
 	int change = 1;
 	wcmUSBData* private = common->private;
@@ -1269,7 +1753,7 @@ static void usbParseAbsMTEvent(WacomCommonPtr common, struct input_event *event)
 			/* set this here as type for this channel doesn't get set in usbDispatchEvent() */
 			ds->device_type = TOUCH_ID;
 			ds->device_id = TOUCH_DEVICE_ID;
-			ds->sample = (int)GetTimeInMillis();
+			ds->sample = TIME_US_TO_MS(usbEventTime(event));
 			break;
 
 		case ABS_MT_POSITION_X:
@@ -1288,17 +1772,17 @@ static void usbParseAbsMTEvent(WacomCommonPtr common, struct input_event *event)
 			change = 0;
 	}
 
-	ds->time = (int)GetTimeInMillis();
-	(&common->wcmChannel[private->wcmMTChannel])->dirty |= change;
+	wcmSetStateTime(ds, usbEventTime(event));
+	usbMarkDirty(common, private->wcmMTChannel, change);
 }
 
 static void usbParseKeyEvent(WacomCommonPtr common,
-			    struct input_event *event, int channel_number)
+			    const struct input_event *event, int channel_number)
 {
 	int change = 1;
 	WacomChannel *channel = &common->wcmChannel[channel_number];
 	WacomDeviceState *ds = &channel->work;
-	WacomDeviceState *dslast = &channel->valid.state;
+	WacomDeviceState *dslast = wcmChannelState(channel, 0);
 
 	/* BTN_TOOL_* are sent to indicate when a specific tool is going
 	 * in our out of proximity.  When going in proximity, here we
@@ -1380,7 +1864,7 @@ static void usbParseKeyEvent(WacomCommonPtr common,
 			/* time stamp for 2FGT gesture events */
 			if ((ds->proximity && !dslast->proximity) ||
 			    (!ds->proximity && dslast->proximity))
-				ds->sample = (int)GetTimeInMillis();
+				ds->sample = TIME_US_TO_MS(usbEventTime(event));
 			break;
 
 		case BTN_TOOL_TRIPLETAP:
@@ -1392,7 +1876,7 @@ static void usbParseKeyEvent(WacomCommonPtr common,
 			/* time stamp for 2GT gesture events */
 			if ((ds->proximity && !dslast->proximity) ||
 			    (!ds->proximity && dslast->proximity))
-				ds->sample = (int)GetTimeInMillis();
+				ds->sample = TIME_US_TO_MS(usbEventTime(event));
 			/* Second finger events will be considered in
 			 * combination with the first finger data */
 			break;
@@ -1401,8 +1885,8 @@ static void usbParseKeyEvent(WacomCommonPtr common,
 			change = 0;
 	}
 
-	ds->time = (int)GetTimeInMillis();
-	channel->dirty |= change;
+	wcmSetStateTime(ds, usbEventTime(event));
+	usbMarkDirty(common, channel_number, change);
 
 	if (change)
 		return;
@@ -1428,19 +1912,25 @@ static void usbParseKeyEvent(WacomCommonPtr common,
 			change = 0;
 	}
 
-	ds->time = (int)GetTimeInMillis();
-	channel->dirty |= change;
+	wcmSetStateTime(ds, usbEventTime(event));
+	usbMarkDirty(common, channel_number, change);
 }
 
 /* Handle all button presses except for stylus buttons */
 static void usbParseBTNEvent(WacomCommonPtr common,
-			    struct input_event *event, int channel_number)
+			    const struct input_event *event, int channel_number)
 {
 	int nkeys;
 	int change = 1;
 	wcmUSBData *usbdata = common->private;
-	WacomChannel *channel = &common->wcmChannel[channel_number];
-	WacomDeviceState *ds = &channel->work;
+	WacomDeviceState *ds = &common->wcmChannel[channel_number].work;
+
+	/* Button events can be from puck or expresskeys */
+	if (ds->device_type != CURSOR_ID)
+	{
+		channel_number = PAD_CHANNEL(common);
+		ds = &common->wcmChannel[channel_number].work;
+	}
 
 	switch (event->code)
 	{
@@ -1479,10 +1969,52 @@ static void usbParseBTNEvent(WacomCommonPtr common,
 				change = 0;
 	}
 
-	ds->time = (int)GetTimeInMillis();
-	channel->dirty |= change;
+	wcmSetStateTime(ds, usbEventTime(event));
+	usbMarkDirty(common, channel_number, change);
 }
 
+static void usbParseWheelEvent(WacomCommonPtr common,
+			       const struct input_event *event, int channel_number)
+{
+	WacomDeviceState *ds = &common->wcmChannel[channel_number].work;
+
+	ds->relwheel = -event->value;
+	wcmSetStateTime(ds, usbEventTime(event));
+	usbMarkDirty(common, channel_number, TRUE);
+}
+
+static void usbParseRelEvent(WacomCommonPtr common,
+			     const struct input_event *event, int channel_number)
+{
+	wcmLogDeferred(common, LOG_REL_EVENT, event->code, 0, 0);
+}
+
+static void usbParseSwitchEvent(WacomCommonPtr common,
+				const struct input_event *event, int channel_number)
+{
+	/* touch is disabled when SW_MUTE_DEVICE is set */
+	int touch_enabled = (event->value == 0);
+
+	if (touch_enabled != common->wcmHWTouchSwitchState)
+	/* this property is only set for touch device */
+		wcmUpdateHWTouchProperty(
+			common->wcmTouchDevice,
+			touch_enabled);
+}
+
+static void (* const usbEventHandlers[])(WacomCommonPtr common,
+					 const struct input_event *event,
+					 int channel_number) = {
+	[USB_EVENT_DROP] = NULL,
+	[USB_EVENT_ABS] = usbParseAbsEvent,
+	[USB_EVENT_ABS_MT] = usbParseAbsMTEvent,
+	[USB_EVENT_KEY] = usbParseKeyEvent,
+	[USB_EVENT_BTN] = usbParseBTNEvent,
+	[USB_EVENT_WHEEL] = usbParseWheelEvent,
+	[USB_EVENT_REL] = usbParseRelEvent,
+	[USB_EVENT_SW] = usbParseSwitchEvent,
+};
+
 /**
  * Translates an event code from the kernel (e.g. type: EV_ABS code: ABS_MISC value: STYLUS_DEVICE_ID)
  * into the corresponding device type for the driver (e.g. STYLUS_ID).
@@ -1548,28 +2080,23 @@ static int deviceTypeFromEvent(WacomCommonPtr common, int type, int code, int va
 }
 
 /**
- * Queries the kernel through EVIOCGKEY for the latest device type
- * information. The result is the first tool type (e.g. STYLUS_ID)
- * found associated with the in-prox tool.
+ * Looks up the latest device type information in the key state. The
+ * result is the first tool type (e.g. STYLUS_ID) found associated with
+ * the in-prox tool.
  *
  * @param[in] common
  * @return            A tool type (e.g. STYLUS_ID) associated with the in-prox tool
  */
-static int refreshDeviceType(WacomCommonPtr common, int fd)
+static int refreshDeviceType(WacomCommonPtr common)
 {
+	wcmUSBData* private = common->private;
 	int device_type = 0;
-	unsigned long keys[NBITS(KEY_MAX)] = { 0 };
-	int rc = ioctl(fd, EVIOCGKEY(sizeof(keys)), keys);
 	int i;
 
-	if (rc == -1) {
-		xf86Msg(X_ERROR, "%s: failed to retrieve key bits\n", common->device_path);
-		return 0;
-	}
-
-	for (i = 0; i < KEY_MAX; i++)
+	/* only BTN_TOOL_* and BTN_TOUCH name a tool */
+	for (i = BTN_TOOL_PEN; i <= BTN_TOOL_TRIPLETAP; i++)
 	{
-		if (ISBITSET(keys, i))
+		if (ISBITSET(private->wcmKeyState, i))
 			device_type = deviceTypeFromEvent(common, EV_KEY, i, 0);
 		if (device_type)
 			return device_type;
@@ -1618,11 +2145,11 @@ static int deriveDeviceTypeFromButtonEvent(WacomCommonPtr common,
  * @param[in] last_device_type The device type for the last event
  *
  * @return The tool type. This falls back on last_device_type if no
- *         pen/touch/eraser event code in the event, and on EVIOCGKEY
- *         if last_device_type is not a tool. If all else fails, '0'
+ *         pen/touch/eraser event code in the event, and on the key
+ *         state if last_device_type is not a tool. If all else fails, '0'
  *         is returned.
  */
-static int usbInitToolType(WacomCommonPtr common, int fd,
+static int usbInitToolType(WacomCommonPtr common,
                            const struct input_event *event_ptr,
                            int nevents, int last_device_type)
 {
@@ -1637,7 +2164,7 @@ static int usbInitToolType(WacomCommonPtr common, int fd,
 		device_type = last_device_type;
 
 	if (!device_type)
-		device_type = refreshDeviceType(common, fd);
+		device_type = refreshDeviceType(common);
 
 	if (!device_type) /* expresskey pressed at startup or missing type */
 		for (i = 0; (i < nevents) && !device_type; ++i, event_ptr++)
@@ -1662,22 +2189,22 @@ static Bool usbIsTabletToolInProx(int device_type, int proximity)
 	return (is_tablet_tool && proximity);
 }
 
-static void usbDispatchEvents(InputInfoPtr pInfo)
+static void usbDispatchEvents(InputInfoPtr pInfo,
+			      const struct input_event *events, int nevents)
 {
-	int i, c;
+	int i, c, touch;
 	WacomDeviceState *ds;
-	struct input_event* event;
+	const struct input_event* event;
 	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
 	WacomCommonPtr common = priv->common;
-	int channel;
+	int channel, handler;
 	wcmUSBData* private = common->private;
-	WacomDeviceState dslast = common->wcmChannel[private->lastChannel].valid.state;
+	WacomDeviceState dslast = *wcmChannelState(&common->wcmChannel[private->lastChannel], 0);
 
-	DBG(6, common, "%d events received\n", private->wcmEventCnt);
+	DBG(6, common, "%d events received\n", nevents);
 
-	private->wcmDeviceType = usbInitToolType(common, pInfo->fd,
-	                                         private->wcmEvents,
-	                                         private->wcmEventCnt,
+	private->wcmDeviceType = usbInitToolType(common,
+	                                         events, nevents,
 	                                         dslast.device_type);
 
 	if (private->wcmPenTouch)
@@ -1691,28 +2218,22 @@ static void usbDispatchEvents(InputInfoPtr pInfo)
 		 */
 		if ((private->wcmDeviceType == TOUCH_ID) &&
 				usbIsTabletToolInProx(dslast.device_type, dslast.proximity))
-		{
-			private->wcmEventCnt = 0;
 			return;
-		}
 	}
 
 	private->wcmLastToolSerial = protocol5Serial(private->wcmDeviceType, private->wcmLastToolSerial);
 	channel = usbChooseChannel(common, private->wcmDeviceType, private->wcmLastToolSerial);
 
 	/* couldn't decide channel? invalid data */
-	if (channel == -1) {
-		private->wcmEventCnt = 0;
+	if (channel == -1)
 		return;
-	}
 
 	ds = &common->wcmChannel[channel].work;
-	dslast = common->wcmChannel[channel].valid.state;
+	dslast = *wcmChannelState(&common->wcmChannel[channel], 0);
 
 	if (ds->device_type && ds->device_type != private->wcmDeviceType)
-		LogMessageVerbSigSafe(X_ERROR, 0,
-				      "usbDispatchEvents: Device Type mismatch - %d -> %d. This is a BUG.\n",
-				      ds->device_type, private->wcmDeviceType);
+		wcmLogDeferred(common, LOG_DEVICE_TYPE_MISMATCH,
+			       ds->device_type, private->wcmDeviceType, 0);
 	/* no device type? */
 	if (!ds->device_type && private->wcmDeviceType) {
 		ds->device_type = private->wcmDeviceType;
@@ -1722,63 +2243,20 @@ static void usbDispatchEvents(InputInfoPtr pInfo)
 	/* all USB data operates from previous context except relative values*/
 	ds->relwheel = 0;
 	ds->serial_num = private->wcmLastToolSerial;
+	touch = (private->wcmDeviceType == TOUCH_ID);
 
 	/* loop through all events in group */
-	for (i=0; i<private->wcmEventCnt; ++i)
+	for (i=0; i<nevents; ++i)
 	{
-		event = private->wcmEvents + i;
-		DBG(11, common,
-			"event[%d]->type=%d code=%d value=%d\n",
-			i, event->type, event->code, event->value);
-
-		/* Check for events to be ignored and skip them up front. */
-		if (usbFilterEvent(common, event))
-			continue;
-
-		if (common->wcmHasHWTouchSwitch)
-		{
-			if ((event->type == EV_SW) &&
-			    (event->code == SW_MUTE_DEVICE))
-			{
-				/* touch is disabled when SW_MUTE_DEVICE is set */
-				int touch_enabled = (event->value == 0);
-
-				if (touch_enabled != common->wcmHWTouchSwitchState)
-				/* this property is only set for touch device */
-					wcmUpdateHWTouchProperty(
-						common->wcmTouchDevice,
-						touch_enabled);
-			}
-		}
+		event = events + i;
+		handler = usbEventHandler(private, event, touch);
+		TRACE(TRACE_USB, common, TP_USB_EVENT, channel, event->type,
+		      event->code, event->value, handler);
 
-		/* absolute events */
-		if (event->type == EV_ABS)
-		{
-			usbParseAbsEvent(common, event, channel);
-			usbParseAbsMTEvent(common, event);
-		}
-		else if (event->type == EV_REL)
-		{
-			if (event->code == REL_WHEEL)
-			{
-				ds->relwheel = -event->value;
-				ds->time = (int)GetTimeInMillis();
-				common->wcmChannel[channel].dirty |= TRUE;
-			}
-			else
-				LogMessageVerbSigSafe(X_ERROR, 0,
-						      "%s: rel event recv'd (%d)!\n",
-						      pInfo->name, event->code);
-		}
-		else if (event->type == EV_KEY)
-		{
-			/* Button events can be from puck or expresskeys */
-			int btn_channel = (ds->device_type == CURSOR_ID) ?
-					   channel : PAD_CHANNEL;
-
-			usbParseKeyEvent(common, event, channel);
-			usbParseBTNEvent(common, event, btn_channel);
-		}
+		if (handler != USB_EVENT_DROP)
+			usbEventHandlers[handler](common, event, channel);
+		else
+			common->wcmStats[STAT_FILTERED]++;
 	} /* next event */
 
 	/* DTF720 and DTF720a don't support eraser */
@@ -1792,24 +2270,10 @@ static void usbDispatchEvents(InputInfoPtr pInfo)
 
 	/* verify we have minimal data when entering prox */
 	if (ds->proximity && !dslast.proximity) {
-		struct input_absinfo absinfo;
-
-		if (!ds->x && !IsPad(priv)) {
-			if (ioctl(priv->pInfo->fd, EVIOCGABS(ABS_X), &absinfo) < 0)
-			{
-				DBG(-1, common, "unable to ioctl current x value.\n");
-				return;
-			}
-			ds->x = absinfo.value;
-		}
-		if (!ds->y && !IsPad(priv)) {
-			if (ioctl(priv->pInfo->fd, EVIOCGABS(ABS_Y), &absinfo) < 0)
-			{
-				DBG(-1, common, "unable to ioctl current x value.\n");
-				return;
-			}
-			ds->y = absinfo.value;
-		}
+		if (!ds->x && !IsPad(priv))
+			ds->x = private->wcmAbsState[ABS_X];
+		if (!ds->y && !IsPad(priv))
+			ds->y = private->wcmAbsState[ABS_Y];
 	}
 
 	/*reset the serial number when the tool is going out */
@@ -1818,18 +2282,332 @@ static void usbDispatchEvents(InputInfoPtr pInfo)
 
 	private->lastChannel = channel;
 
-	for (c = 0; c < MAX_CHANNELS; c++) {
-		ds = &common->wcmChannel[c].work;
+	/* walk through the dirty channels only */
+	for (i = 0; i < NBITS(common->wcmChannelCnt); i++) {
+		unsigned long dirty = common->wcmDirtyChannels[i];
+
+		common->wcmDirtyChannels[i] = 0;
+		for (; dirty; dirty &= dirty - 1) {
+			c = i * BITS_PER_LONG + __builtin_ctzl(dirty);
+			ds = &common->wcmChannel[c].work;
 
-		/* walk through all channels */
-		if (common->wcmChannel[c].dirty) {
 			DBG(10, common, "Dirty flag set on channel %d; sending event.\n", c);
-			common->wcmChannel[c].dirty = FALSE;
 			/* don't send touch event when touch isn't enabled */
 			if (ds->device_type != TOUCH_ID || common->wcmTouch)
 				wcmEvent(common, c, ds);
+			usbReleaseChannel(common, c);
+		}
+	}
+}
+
+/**
+ * Fetch the current key and axis state from the kernel. Between two
+ * fetches usbUpdateState keeps it up to date from the events.
+ */
+static int usbFetchState(InputInfoPtr pInfo)
+{
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
+	wcmUSBData* private = common->private;
+	struct input_absinfo absinfo;
+	int i;
+
+	if (ioctl(pInfo->fd, EVIOCGKEY(sizeof(private->wcmKeyState)),
+		  private->wcmKeyState) < 0)
+		return !Success;
+
+	for (i = 0; i < ABS_MT_SLOT; i++)
+		if (ISBITSET(private->wcmAbs, i) &&
+		    !ioctl(pInfo->fd, EVIOCGABS(i), &absinfo))
+			private->wcmAbsState[i] = absinfo.value;
+
+	return Success;
+}
+
+/**
+ * The kernel dropped events because we didn't read them fast enough.
+ * Whatever is queued belongs to an incomplete frame; discard it and
+ * everything up to the next SYN_REPORT, then resync.
+ */
+static void usbSynDropped(InputInfoPtr pInfo)
+{
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
+	wcmUSBData* private = common->private;
+
+	DBG(1, common, "SYN_DROPPED, resyncing (%u)\n", private->wcmResyncs + 1);
+
+	private->wcmSynDropped = TRUE;
+	private->wcmEventCnt = 0;
+}
+
+static void usbResyncEvent(struct input_event *event, uint64_t time_us,
+			   int type, int code, int value)
+{
+	event->input_event_sec = time_us / 1000000;
+	event->input_event_usec = time_us % 1000000;
+	event->type = type;
+	event->code = code;
+	event->value = value;
+}
+
+/* Tool keys for the tool types a channel may hold, see deviceTypeFromEvent */
+static int usbToolKey(WacomCommonPtr common, int device_type)
+{
+	switch (device_type)
+	{
+		case STYLUS_ID:
+			return BTN_TOOL_PEN;
+		case ERASER_ID:
+			return BTN_TOOL_RUBBER;
+		case CURSOR_ID:
+			return BTN_TOOL_MOUSE;
+		case TOUCH_ID:
+			return (common->wcmProtocolLevel == WCM_PROTOCOL_GENERIC) ?
+				BTN_TOOL_FINGER : BTN_TOOL_DOUBLETAP;
+		case PAD_ID:
+			if (deviceTypeFromEvent(common, EV_KEY, BTN_TOOL_FINGER, 0) == PAD_ID)
+				return BTN_TOOL_FINGER;
+			break;
+	}
+
+	return 0;
+}
+
+/* Append the current state of all buttons, returns the number of events */
+static int usbResyncButtons(WacomCommonPtr common, const unsigned long *keys,
+			    struct input_event *frame, uint64_t now)
+{
+	static const unsigned short stylus_codes[] = {
+		BTN_TOUCH, BTN_STYLUS, BTN_STYLUS2
+	};
+	wcmUSBData* private = common->private;
+	int i, n = 0;
+
+	for (i = 0; i < ARRAY_SIZE(stylus_codes); i++)
+		if (ISBITSET(common->wcmKeys, stylus_codes[i]))
+			usbResyncEvent(&frame[n++], now, EV_KEY, stylus_codes[i],
+				       ISBITSET(keys, stylus_codes[i]));
+	for (i = 0; i < ARRAY_SIZE(mouse_codes); i++)
+		if (ISBITSET(common->wcmKeys, mouse_codes[i]))
+			usbResyncEvent(&frame[n++], now, EV_KEY, mouse_codes[i],
+				       ISBITSET(keys, mouse_codes[i]));
+	/* a pad without pad keys uses the mouse buttons, see usbWcmInit */
+	for (i = 0; i < private->npadkeys; i++)
+		if (private->padkey_code[i])
+			usbResyncEvent(&frame[n++], now, EV_KEY, private->padkey_code[i],
+				       ISBITSET(keys, private->padkey_code[i]));
+
+	return n;
+}
+
+/* Axes only the pad reports: strips, rings */
+static Bool usbIsPadAxis(int code)
+{
+	return (code == ABS_RX || code == ABS_RY ||
+		code == ABS_WHEEL || code == ABS_THROTTLE);
+}
+
+/**
+ * Rebuild all channel states after a SYN_DROPPED. The key, axis and slot
+ * state is fetched from the kernel in one pass, then replayed as
+ * synthetic frames through the regular dispatch path:
+ * - a prox-out for every tool that left proximity meanwhile,
+ * - the tool in proximity with all its axes and buttons,
+ * - the pad buttons and axes, on devices that report the pad on its own,
+ * - all touch slots, on MT devices.
+ * Button releases and lifted contacts that got lost are picked up this way,
+ * so no button stays stuck and no touch lingers until the next prox change.
+ */
+static void usbResync(InputInfoPtr pInfo)
+{
+	static const unsigned short tool_codes[] = {
+		BTN_TOOL_PEN, BTN_TOOL_RUBBER, BTN_TOOL_BRUSH, BTN_TOOL_PENCIL,
+		BTN_TOOL_AIRBRUSH, BTN_TOOL_MOUSE, BTN_TOOL_LENS,
+		BTN_TOOL_FINGER, BTN_TOOL_DOUBLETAP, BTN_TOOL_TRIPLETAP
+	};
+	static const unsigned short mt_codes[] = {
+		ABS_MT_TRACKING_ID, ABS_MT_POSITION_X, ABS_MT_POSITION_Y,
+		ABS_MT_PRESSURE
+	};
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
+	wcmUSBData* private = common->private;
+	const unsigned long *keys = private->wcmKeyState;
+	const int *values = private->wcmAbsState;
+	unsigned long abs[NBITS(ABS_MAX)];
+	int nslots = private->wcmUseMT ? common->wcmMaxContacts : 0;
+	int32_t mt[ARRAY_SIZE(mt_codes)][1 + nslots];
+	int size = max(2 + 3 + ARRAY_SIZE(mouse_codes) + WCM_MAX_BUTTONS + ABS_MT_SLOT,
+		       1 + nslots * (1 + ARRAY_SIZE(mt_codes)));
+	struct input_event frame[size];
+	struct input_absinfo absinfo;
+	uint64_t now = wcmTimeUs();
+	int tool_code = 0, tool_type = 0, cur_slot = 0;
+	Bool pad_only;
+	int i, c, n;
+
+	private->wcmResyncs++;
+
+	/* fetch everything up front */
+	if (usbFetchState(pInfo) != Success)
+	{
+		LogMessageVerbSigSafe(X_ERROR, 0,
+				      "%s: unable to resync key state\n",
+				      pInfo->name);
+		return;
+	}
+
+	memcpy(abs, private->wcmAbs, sizeof(abs));
+
+#ifdef EVIOCGMTSLOTS
+	if (nslots > 0 && ISBITSET(abs, ABS_MT_TRACKING_ID))
+	{
+		if (!ioctl(pInfo->fd, EVIOCGABS(ABS_MT_SLOT), &absinfo))
+			cur_slot = absinfo.value;
+
+		for (i = 0; i < ARRAY_SIZE(mt_codes); i++)
+		{
+			mt[i][0] = mt_codes[i];
+			if (!ISBITSET(abs, mt_codes[i]) ||
+			    ioctl(pInfo->fd, EVIOCGMTSLOTS(sizeof(mt[i])), mt[i]) < 0)
+			{
+				if (i == 0)
+					nslots = 0;
+				CLEARBIT(abs, mt_codes[i]);
+			}
 		}
 	}
+	else
+#endif
+		nslots = 0;
+
+	/* the tool in proximity, if any */
+	for (i = 0; i < ARRAY_SIZE(tool_codes) && !tool_type; i++)
+	{
+		if (!ISBITSET(keys, tool_codes[i]))
+			continue;
+
+		if (private->wcmKeyMap[tool_codes[i]] == USB_EVENT_DROP)
+			continue;
+
+		tool_code = tool_codes[i];
+		tool_type = deviceTypeFromEvent(common, EV_KEY, tool_code, 1);
+	}
+
+	/* prox-out the tools that left in the meantime */
+	for (c = 0; c < common->wcmChannelCnt; c++)
+	{
+		WacomDeviceState *ds = &common->wcmChannel[c].work;
+		int code = usbToolKey(common, ds->device_type);
+
+		if (!ds->proximity || !code ||
+		    ds->device_type == tool_type ||
+		    (ds->device_type == TOUCH_ID && private->wcmUseMT))
+			continue;
+
+		DBG(6, common, "resync: %u left proximity\n", ds->serial_num);
+
+		n = 0;
+		usbResyncEvent(&frame[n++], now, EV_KEY, code, 0);
+		n += usbResyncButtons(common, keys, &frame[n], now);
+		for (i = 0; ds->device_type == PAD_ID && i < ABS_MT_SLOT; i++)
+			if (ISBITSET(abs, i) && usbIsPadAxis(i))
+				usbResyncEvent(&frame[n++], now, EV_ABS, i, values[i]);
+		usbResyncEvent(&frame[n++], now, EV_SYN, SYN_REPORT, 0);
+		private->wcmLastToolSerial = ds->serial_num;
+		usbDispatchFrame(pInfo, frame, n);
+	}
+
+	/* a pad on its own has no tool key to go by */
+	pad_only = (private->npadkeys > 0);
+	for (i = 0; i < ARRAY_SIZE(tool_codes); i++)
+		if (ISBITSET(common->wcmKeys, tool_codes[i]) &&
+		    deviceTypeFromEvent(common, EV_KEY, tool_codes[i], 1) != PAD_ID)
+			pad_only = FALSE;
+
+	/* the tool in proximity, with the buttons and all axes */
+	if (tool_type || pad_only)
+	{
+		n = 0;
+
+		if (tool_code)
+			usbResyncEvent(&frame[n++], now, EV_KEY, tool_code, 1);
+		n += usbResyncButtons(common, keys, &frame[n], now);
+
+		for (i = 0; i < ABS_MT_SLOT; i++)
+		{
+			/* the pad only gets its own axes, the tools get
+			 * everything but the strips */
+			if (!ISBITSET(abs, i) ||
+			    (tool_type == PAD_ID && !usbIsPadAxis(i)) ||
+			    (tool_type && tool_type != PAD_ID &&
+			     (i == ABS_RX || i == ABS_RY)))
+				continue;
+
+			usbResyncEvent(&frame[n++], now, EV_ABS, i, values[i]);
+		}
+
+		usbResyncEvent(&frame[n++], now, EV_SYN, SYN_REPORT, 0);
+
+		/* stay on the channel the tool is already in */
+		private->wcmLastToolSerial = 0;
+		for (c = 0; c < common->wcmChannelCnt; c++)
+		{
+			WacomDeviceState *ds = &common->wcmChannel[c].work;
+
+			if (ds->proximity && tool_type &&
+			    ds->device_type == tool_type)
+				private->wcmLastToolSerial = ds->serial_num;
+		}
+
+		/* A protocol 5 tool that came in meanwhile has no serial
+		 * yet, its next frame brings it in with the MSC_SERIAL. */
+		if (common->wcmProtocolLevel == WCM_PROTOCOL_5 &&
+		    !private->wcmLastToolSerial &&
+		    tool_type != PAD_ID && tool_type != TOUCH_ID && !pad_only)
+			DBG(6, common, "resync: waiting for the serial\n");
+		else
+			usbDispatchFrame(pInfo, frame, n);
+	}
+
+	/* all touch slots, the kernel's current slot last so that a frame
+	 * without ABS_MT_SLOT continues where the kernel thinks it does */
+	n = 0;
+	for (i = 1; i <= nslots; i++)
+	{
+		int slot = (cur_slot + i) % nslots;
+		Bool active = (mt[0][1 + slot] != -1);
+		Bool in_prox = FALSE;
+		int j;
+
+		for (c = 0; c < common->wcmChannelCnt; c++)
+		{
+			WacomDeviceState *ds = &common->wcmChannel[c].work;
+
+			if (ds->proximity && ds->device_type == TOUCH_ID &&
+			    ds->serial_num == slot + 1)
+				in_prox = TRUE;
+		}
+
+		if (!active && !in_prox)
+			continue;
+
+		usbResyncEvent(&frame[n++], now, EV_ABS, ABS_MT_SLOT, slot);
+		usbResyncEvent(&frame[n++], now, EV_ABS, ABS_MT_TRACKING_ID,
+			       mt[0][1 + slot]);
+		for (j = 1; active && j < ARRAY_SIZE(mt_codes); j++)
+			if (ISBITSET(abs, mt_codes[j]))
+				usbResyncEvent(&frame[n++], now, EV_ABS, mt_codes[j],
+					       mt[j][1 + slot]);
+	}
+
+	if (n)
+	{
+		usbResyncEvent(&frame[n++], now, EV_SYN, SYN_REPORT, 0);
+		private->wcmLastToolSerial = 0;
+		usbDispatchFrame(pInfo, frame, n);
+	}
 }
 
 /* Quirks to unify the tool and tablet types for GENERIC protocol tablet PCs
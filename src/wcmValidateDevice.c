@@ -761,6 +761,7 @@ Bool wcmPreInitParseOptions(InputInfoPtr pInfo, Bool is_primary,
 	int		i;
 	WacomToolPtr    tool = NULL;
 	int		tpc_button_is_on;
+	int		suppress;
 
 	/* Optional configuration */
 	s = xf86SetStrOption(pInfo->options, "Mode", NULL);
@@ -830,6 +831,31 @@ Bool wcmPreInitParseOptions(InputInfoPtr pInfo, Bool is_primary,
 		common->wcmRawSample = DEFAULT_SAMPLES;
 	}
 
+	s = xf86SetStrOption(pInfo->options, "FilterMode", NULL);
+	if (s)
+	{
+		if (xf86NameCmp(s, "Average") == 0)
+			common->wcmFilterMode = FILTER_MODE_AVERAGE;
+		else if (xf86NameCmp(s, "OneEuro") == 0)
+			common->wcmFilterMode = FILTER_MODE_ONE_EURO;
+		else if (xf86NameCmp(s, "Kalman") == 0)
+			common->wcmFilterMode = FILTER_MODE_KALMAN;
+		else
+			xf86Msg(X_ERROR, "%s: invalid FilterMode option '%s'. Using default.\n",
+				pInfo->name, s);
+		free(s);
+	}
+
+	common->wcmPredict = xf86SetIntOption(pInfo->options, "Predict",
+			common->wcmPredict);
+	if (common->wcmPredict < 0 || common->wcmPredict > MAX_PREDICT)
+	{
+		xf86Msg(X_ERROR, "%s: Predict setting '%d' out of range [0..%d]. Disabling prediction.\n",
+			pInfo->name, common->wcmPredict, MAX_PREDICT);
+		common->wcmPredict = 0;
+	}
+
+	suppress = common->wcmSuppress;
 	common->wcmSuppress = xf86SetIntOption(pInfo->options, "Suppress",
 			common->wcmSuppress);
 	if (common->wcmSuppress != 0) /* 0 disables suppression */
@@ -839,6 +865,10 @@ Bool wcmPreInitParseOptions(InputInfoPtr pInfo, Bool is_primary,
 		if (common->wcmSuppress < DEFAULT_SUPPRESS)
 			common->wcmSuppress = DEFAULT_SUPPRESS;
 	}
+	/* the tablet is up already if this tool shares it, keep its
+	 * thresholds unless this tool asks for another level */
+	if (common->refcnt > 1 && common->wcmSuppress != suppress)
+		wcmSetSuppress(common, common->wcmSuppress);
 
 	/* pressure curve takes control points x1,y1,x2,y2
 	 * values in range from 0..100.
@@ -905,6 +935,7 @@ Bool wcmPreInitParseOptions(InputInfoPtr pInfo, Bool is_primary,
 			toollist->next = tool;
 		}
 	}
+	wcmRebuildToolIndex(common);
 
 	common->wcmThreshold = xf86SetIntOption(pInfo->options, "Threshold",
 			common->wcmThreshold);
@@ -1028,6 +1059,14 @@ Bool wcmPostInitParseOptions(InputInfoPtr pInfo, Bool is_primary,
 	common->wcmMaxZ = xf86SetIntOption(pInfo->options, "MaxZ",
 					   common->wcmMaxZ);
 
+	/* the axis ranges are known now, derive the suppress thresholds.
+	 * Tools sharing the tablet later must not reset custom ones. */
+	if (common->refcnt == 1)
+		wcmSetSuppress(common, common->wcmSuppress);
+
+	priv->stageTiming = xf86SetBoolOption(pInfo->options, "StageTiming",
+					      priv->stageTiming);
+
 	/* 2FG touch device */
 	if (TabletHasFeature(common, WCM_2FGT) && IsTouch(priv))
 	{
@@ -23,6 +23,7 @@
 
 #include "xf86Wacom.h"
 #include "wcmFilter.h"
+#include "wcmTrace.h"
 #include <exevents.h>
 #include <xf86_OSproc.h>
 
@@ -84,12 +85,17 @@ static Atom prop_rotation;
 static Atom prop_tablet_area;
 static Atom prop_pressurecurve;
 static Atom prop_serials;
+static Atom prop_latency;
+static Atom prop_statistics;
+static Atom prop_recorder;
 static Atom prop_serial_binding;
 static Atom prop_strip_buttons;
 static Atom prop_wheel_buttons;
 static Atom prop_cursorprox;
 static Atom prop_threshold;
 static Atom prop_suppress;
+static Atom prop_filter_mode;
+static Atom prop_predict;
 static Atom prop_touch;
 static Atom prop_hardware_touch;
 static Atom prop_gesture;
@@ -102,6 +108,9 @@ static Atom prop_pressure_recal;
 #ifdef DEBUG
 static Atom prop_debuglevels;
 #endif
+#ifdef WCM_TRACING
+static Atom prop_trace;
+#endif
 
 /**
  * Resets an arbitrary Action property, given a pointer to the old
@@ -247,6 +256,15 @@ void InitWcmDeviceProperties(InputInfoPtr pInfo)
 	values[4] = priv->cur_device_id;
 	prop_serials = InitWcmAtom(pInfo->dev, WACOM_PROP_SERIALIDS, XA_INTEGER, 32, 5, values);
 
+	memset(values, 0, LATENCY_BUCKETS * sizeof(values[0]));
+	prop_latency = InitWcmAtom(pInfo->dev, WACOM_PROP_LATENCY_HISTOGRAM, XA_INTEGER, 32, LATENCY_BUCKETS, values);
+
+	memset(values, 0, STAT_COUNT * sizeof(values[0]));
+	prop_statistics = InitWcmAtom(pInfo->dev, WACOM_PROP_STATISTICS, XA_INTEGER, 32, STAT_COUNT, values);
+
+	values[0] = 0;
+	prop_recorder = InitWcmAtom(pInfo->dev, WACOM_PROP_FLIGHT_RECORDER, XA_INTEGER, 8, 1, values);
+
 	values[0] = priv->serial;
 	prop_serial_binding = InitWcmAtom(pInfo->dev, WACOM_PROP_SERIAL_BIND, XA_INTEGER, 32, 1, values);
 
@@ -260,7 +278,16 @@ void InitWcmDeviceProperties(InputInfoPtr pInfo)
 
 	values[0] = common->wcmSuppress;
 	values[1] = common->wcmRawSample;
-	prop_suppress = InitWcmAtom(pInfo->dev, WACOM_PROP_SAMPLE, XA_INTEGER, 32, 2, values);
+	memcpy(values + 2, common->wcmSuppressAxis, sizeof(common->wcmSuppressAxis));
+	prop_suppress = InitWcmAtom(pInfo->dev, WACOM_PROP_SAMPLE, XA_INTEGER, 32, 2 + SUPPRESS_AXIS_COUNT, values);
+
+	values[0] = common->wcmFilterMode;
+	prop_filter_mode = InitWcmAtom(pInfo->dev, WACOM_PROP_FILTER_MODE, XA_INTEGER, 8, 1, values);
+
+	if (IsPen(priv)) {
+		values[0] = common->wcmPredict;
+		prop_predict = InitWcmAtom(pInfo->dev, WACOM_PROP_PREDICT, XA_INTEGER, 32, 1, values);
+	}
 
 	values[0] = common->wcmTouch;
 	prop_touch = InitWcmAtom(pInfo->dev, WACOM_PROP_TOUCH, XA_INTEGER, 8, 1, values);
@@ -322,6 +349,11 @@ void InitWcmDeviceProperties(InputInfoPtr pInfo)
 	values[1] = common->debugLevel;
 	prop_debuglevels = InitWcmAtom(pInfo->dev, WACOM_PROP_DEBUGLEVELS, XA_INTEGER, 8, 2, values);
 #endif
+
+#ifdef WCM_TRACING
+	values[0] = common->wcmTraceMask;
+	prop_trace = InitWcmAtom(pInfo->dev, WACOM_PROP_TRACE, XA_INTEGER, 32, 1, values);
+#endif
 }
 
 /* Returns the offset of the property in the list given. If the property is
@@ -739,8 +771,12 @@ int wcmSetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
 	} else if (property == prop_suppress)
 	{
 		CARD32 *values;
+		int i;
 
-		if (prop->size != 2 || prop->format != 32)
+		/* clients that predate the thresholds only write the
+		 * level and the sample window */
+		if ((prop->size != 2 && prop->size != 2 + SUPPRESS_AXIS_COUNT) ||
+		    prop->format != 32)
 			return BadValue;
 
 		values = (CARD32*)prop->data;
@@ -751,11 +787,51 @@ int wcmSetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
 		if ((values[1] < 1) || (values[1] > MAX_SAMPLES))
 			return BadValue;
 
+		for (i = 0; i < prop->size - 2; i++)
+			if ((int)values[2 + i] < 0)
+				return BadValue;
+
 		if (!checkonly)
 		{
-			common->wcmSuppress = values[0];
 			common->wcmRawSample = values[1];
+
+			/* a new level resets the thresholds, xsetwacom
+			 * writes back the old ones along with it */
+			if (prop->size == 2 ||
+			    (int)values[0] != common->wcmSuppress)
+				wcmSetSuppress(common, values[0]);
+			else
+				for (i = 0; i < SUPPRESS_AXIS_COUNT; i++)
+					common->wcmSuppressAxis[i] = values[2 + i];
 		}
+	} else if (property == prop_filter_mode)
+	{
+		CARD8 value;
+
+		if (prop->size != 1 || prop->format != 8)
+			return BadValue;
+
+		value = *(CARD8*)prop->data;
+
+		if (value >= FILTER_MODE_COUNT)
+			return BadValue;
+
+		if (!checkonly)
+			common->wcmFilterMode = value;
+	} else if (property == prop_predict)
+	{
+		INT32 value;
+
+		if (prop->size != 1 || prop->format != 32)
+			return BadValue;
+
+		value = *(INT32*)prop->data;
+
+		if (value < 0 || value > MAX_PREDICT)
+			return BadValue;
+
+		if (!checkonly)
+			common->wcmPredict = value;
 	} else if (property == prop_rotation)
 	{
 		CARD8 value;
@@ -781,6 +857,53 @@ int wcmSetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
 				return Success;
 
 		return BadValue; /* Read-only */
+	} else if (property == prop_latency)
+	{
+		/* Read-only too, but wcmGetProperty refreshes it. The
+		 * counters only ever grow, so a histogram above them
+		 * didn't come from us. */
+		CARD32 *latency = (CARD32*)prop->data;
+		int i;
+
+		if (prop->size != LATENCY_BUCKETS || prop->format != 32)
+			return BadValue;
+
+		for (i = 0; i < LATENCY_BUCKETS; i++)
+			if (latency[i] > priv->latency[i])
+				return BadValue; /* Read-only */
+	} else if (property == prop_statistics)
+	{
+		/* Read-only, refreshed by wcmGetProperty like the latency
+		 * histogram above. */
+		CARD32 *stats = (CARD32*)prop->data;
+		uint32_t current[STAT_COUNT];
+		int i;
+
+		if (prop->size != STAT_COUNT || prop->format != 32)
+			return BadValue;
+
+		wcmGetStatistics(priv, current);
+		for (i = 0; i < STAT_COUNT; i++)
+		{
+			uint64_t value = stats[i], now = current[i];
+
+			/* the low word of a 64 bit counter wraps */
+			if (STAT_IS_64BIT(i))
+			{
+				i++;
+				value |= (uint64_t)stats[i] << 32;
+				now |= (uint64_t)current[i] << 32;
+			}
+			if (value > now)
+				return BadValue; /* Read-only */
+		}
+	} else if (property == prop_recorder)
+	{
+		if (prop->size != 1 || prop->format != 8)
+			return BadValue;
+
+		if (!checkonly && *(CARD8*)prop->data)
+			return wcmRecorderDump(common);
 	} else if (property == prop_serial_binding)
 	{
 		unsigned int serial;
@@ -917,6 +1040,28 @@ int wcmSetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
 			priv->debugLevel = values[0];
 			common->debugLevel = values[1];
 		}
+#endif
+#ifdef WCM_TRACING
+	} else if (property == prop_trace)
+	{
+		CARD32 mask;
+
+		if (prop->size != 1 || prop->format != 32)
+			return BadMatch;
+
+		mask = *(CARD32*)prop->data;
+		if (mask & ~TRACE_ALL)
+			return BadValue;
+
+		if (!checkonly)
+		{
+			int disabled = common->wcmTraceMask & ~mask;
+
+			if (!wcmSetTraceMask(common, mask))
+				return BadAlloc;
+			if (disabled)
+				wcmTraceDump(common);
+		}
 #endif
 	} else if (property == prop_btnactions)
 	{
@@ -973,6 +1118,45 @@ int wcmGetProperty (DeviceIntPtr dev, Atom property)
 					      PropModeReplace, 5,
 					      values, FALSE);
 	}
+	else if (property == prop_suppress)
+	{
+		uint32_t values[2 + SUPPRESS_AXIS_COUNT];
+		int i;
+
+		/* the thresholds are recomputed once the axis ranges are
+		 * known, a stale copy would be written back by the next
+		 * read-modify-write of the property */
+		values[0] = common->wcmSuppress;
+		values[1] = common->wcmRawSample;
+		for (i = 0; i < SUPPRESS_AXIS_COUNT; i++)
+			values[2 + i] = common->wcmSuppressAxis[i];
+
+		return XIChangeDeviceProperty(dev, property, XA_INTEGER, 32,
+					      PropModeReplace, 2 + SUPPRESS_AXIS_COUNT,
+					      values, FALSE);
+	}
+	else if (property == prop_latency)
+	{
+		uint32_t values[LATENCY_BUCKETS];
+
+		/* the input thread may bump a counter meanwhile, a slightly
+		 * stale snapshot is fine */
+		memcpy(values, priv->latency, sizeof(values));
+
+		return XIChangeDeviceProperty(dev, property, XA_INTEGER, 32,
+					      PropModeReplace, LATENCY_BUCKETS,
+					      values, FALSE);
+	}
+	else if (property == prop_statistics)
+	{
+		uint32_t values[STAT_COUNT];
+
+		wcmGetStatistics(priv, values);
+
+		return XIChangeDeviceProperty(dev, property, XA_INTEGER, 32,
+					      PropModeReplace, STAT_COUNT,
+					      values, FALSE);
+	}
 	else if (property == prop_btnactions)
 	{
 		/* Convert the physical button representation used internally
@@ -44,6 +44,7 @@
 #include <unistd.h>
 
 #include "xf86Wacom.h"
+#include "wcmTrace.h"
 #include <xf86_OSproc.h>
 #include <exevents.h>           /* Needed for InitValuator/Proximity stuff */
 
@@ -561,6 +562,7 @@ static int wcmDevOpen(DeviceIntPtr pWcm)
 	WacomCommonPtr common = priv->common;
 	WacomModelPtr model = common->wcmModel;
 	struct stat st;
+	int flags;
 
 	DBG(10, priv, "\n");
 
@@ -601,6 +603,15 @@ static int wcmDevOpen(DeviceIntPtr pWcm)
 	}
 
 got_fd:
+	/* Drain the device on each wakeup if reads can't block, otherwise
+	 * poll before every read. */
+	flags = fcntl(pInfo->fd, F_GETFL);
+	if (flags != -1 && !(flags & O_NONBLOCK) &&
+	    fcntl(pInfo->fd, F_SETFL, flags | O_NONBLOCK) == 0)
+		flags |= O_NONBLOCK;
+	common->wcmReadDrain = (flags != -1 && (flags & O_NONBLOCK));
+	DBG(1, priv, "read mode: %s\n", common->wcmReadDrain ? "drain" : "poll");
+
 	/* start the tablet data */
 	if (model->Start && (model->Start(pInfo) != Success))
 		return !Success;
@@ -621,6 +632,25 @@ static int wcmReady(InputInfoPtr pInfo)
 	return 0;
 }
 
+/*****************************************************************************
+ * wcmAdjustReadBudget --
+ *   Grow the number of reads allowed per wakeup when the device had more
+ *   data than we were allowed to read, shrink it when the device is
+ *   drained well before the budget runs out.
+ ****************************************************************************/
+
+TEST_NON_STATIC void wcmAdjustReadBudget(WacomCommonPtr common, int reads)
+{
+	if (reads >= common->wcmReadBudget)
+	{
+		common->wcmReadBudgetExhausted++;
+		DBG(1, common, "Can't keep up!!! (%u times, budget %d)\n",
+		    common->wcmReadBudgetExhausted, common->wcmReadBudget);
+		common->wcmReadBudget = min(common->wcmReadBudget * 2, MAX_READ_BUDGET);
+	} else if (reads * 4 < common->wcmReadBudget)
+		common->wcmReadBudget = max(common->wcmReadBudget / 2, MIN_READ_BUDGET);
+}
+
 /*****************************************************************************
  * wcmDevReadInput --
  *   Read the device on IO signal
@@ -628,9 +658,25 @@ static int wcmReady(InputInfoPtr pInfo)
 
 static void wcmDevReadInput(InputInfoPtr pInfo)
 {
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
 	int loop=0;
 	#define MAX_READ_LOOPS 10
 
+	if (common->wcmReadDrain)
+	{
+		/* read until EAGAIN or the budget for this wakeup is spent */
+		for (loop=0; loop < common->wcmReadBudget; ++loop)
+		{
+			if (wcmReadPacket(pInfo) <= 0)
+				break;
+		}
+
+		DBG(10, priv, "Read (%d)\n", loop);
+		wcmAdjustReadBudget(common, loop);
+		return;
+	}
+
 	/* move data until we exhaust the device */
 	for (loop=0; loop < MAX_READ_LOOPS; ++loop)
 	{
@@ -645,8 +691,6 @@ static void wcmDevReadInput(InputInfoPtr pInfo)
 	/* report how well we're doing */
 	if (loop > 0)
 	{
-		WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
-
 		if (loop >= MAX_READ_LOOPS)
 			DBG(1, priv, "Can't keep up!!!\n");
 		else
@@ -655,61 +699,118 @@ static void wcmDevReadInput(InputInfoPtr pInfo)
 #endif
 }
 
-void wcmReadPacket(InputInfoPtr pInfo)
+/*****************************************************************************
+ * wcmParseBuffer --
+ *   Hand the unparsed data in the reception ring to the model parser. A
+ *   packet spanning the end of the ring is made contiguous by mirroring the
+ *   start of the ring past its end; partial packets are left in place until
+ *   the rest arrives. Only MAX_PACKET_SIZE bytes are mirrored unless the
+ *   parser asks for more.
+ ****************************************************************************/
+
+TEST_NON_STATIC void wcmParseBuffer(InputInfoPtr pInfo)
 {
 	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
 	WacomCommonPtr common = priv->common;
-	int len, pos, cnt, remaining;
-
-	DBG(10, common, "fd=%d\n", pInfo->fd);
-
-	remaining = sizeof(common->buffer) - common->bufpos;
+	unsigned int avail = common->head - common->tail;
+	unsigned int pos, len, wrap;
+	uint64_t now = 0;
+	int cnt;
 
-	DBG(1, common, "pos=%d remaining=%d\n", common->bufpos, remaining);
+	/* the flight recorder stamps all of this data alike */
+	if (common->wcmRecorder && avail > 0)
+		now = wcmTimeUs();
 
-	/* fill buffer with as much data as we can handle */
-	len = xf86ReadSerial(pInfo->fd,
-		common->buffer + common->bufpos, remaining);
-
-	if (len <= 0)
+	while (avail > 0)
 	{
-		/* for all other errors, hope that the hotplugging code will
-		 * remove the device */
-		if (errno != EAGAIN && errno != EINTR)
-			LogMessageVerbSigSafe(X_ERROR, 0,
-					      "%s: Error reading wacom device : %s\n", pInfo->name, strerror(errno));
-		return;
-	}
-
-	/* account for new data */
-	common->bufpos += len;
-	DBG(10, common, "buffer has %d bytes\n", common->bufpos);
+		pos = common->tail & RING_MASK;
+		len = RING_SIZE - pos;
 
-	len = common->bufpos;
-	pos = 0;
+		if (len < avail)
+		{
+			wrap = min(avail - len, MAX_PACKET_SIZE);
+			DBG(7, common, "WRAP %u bytes\n", wrap);
+			memcpy(common->buffer + RING_SIZE, common->buffer, wrap);
+			len += wrap;
+		} else
+			len = avail;
 
-	while (len > 0)
-	{
 		/* parse packet */
 		cnt = common->wcmModel->Parse(pInfo, common->buffer + pos, len);
+		if (cnt == 0 && len < avail)
+		{
+			/* parser needs more than the view, e.g. a whole frame */
+			wrap = avail - (RING_SIZE - pos);
+			DBG(7, common, "WRAP %u bytes\n", wrap);
+			memcpy(common->buffer + RING_SIZE, common->buffer, wrap);
+			cnt = common->wcmModel->Parse(pInfo, common->buffer + pos, avail);
+		}
 		if (cnt <= 0)
 		{
 			if (cnt < 0)
 				DBG(1, common, "Misbehaving parser returned %d\n",cnt);
 			break;
 		}
-		pos += cnt;
-		len -= cnt;
+		wcmRecordRaw(common, now, common->buffer + pos, cnt);
+		common->tail += cnt;
+		avail -= cnt;
+	}
+}
+
+int wcmReadPacket(InputInfoPtr pInfo)
+{
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
+	unsigned int pos, remaining;
+	int len;
+
+	DBG(10, common, "fd=%d\n", pInfo->fd);
+
+	/* a parser that never consumes its data would stall us forever */
+	if (common->head - common->tail >= RING_SIZE)
+	{
+		DBG(1, common, "Ring full, dropping %u bytes\n",
+		    common->head - common->tail);
+		common->tail = common->head;
 	}
 
-	/* if half a packet remains, move it down */
-	if (len)
+	pos = common->head & RING_MASK;
+	remaining = RING_SIZE - (common->head - common->tail);
+
+	DBG(1, common, "pos=%u remaining=%u\n", pos, remaining);
+
+	/* Read all the free space in one go, even past the ring end: the
+	 * buffer is twice RING_SIZE long. Splitting the read at the ring end
+	 * would hand evdev a count smaller than one input_event, which it
+	 * rejects with EINVAL. */
+	len = xf86ReadSerial(pInfo->fd, common->buffer + pos, remaining);
+
+	if (len <= 0)
 	{
-		DBG(7, common, "MOVE %d bytes\n", common->bufpos - pos);
-		memmove(common->buffer,common->buffer+pos, len);
+		/* nothing left to read */
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+
+		/* for all other errors, hope that the hotplugging code will
+		 * remove the device */
+		LogMessageVerbSigSafe(X_ERROR, 0,
+				      "%s: Error reading wacom device : %s\n", pInfo->name, strerror(errno));
+		return -1;
 	}
 
-	common->bufpos = len;
+	/* move whatever landed past the ring end back to its start */
+	if (pos + len > RING_SIZE)
+		memcpy(common->buffer, common->buffer + RING_SIZE,
+		       pos + len - RING_SIZE);
+
+	/* account for new data */
+	common->head += len;
+	wcmStatAdd(common->wcmStats, STAT_BYTES_READ, len);
+	DBG(10, common, "buffer has %u bytes\n", common->head - common->tail);
+
+	wcmParseBuffer(pInfo);
+
+	return len;
 }
 
 int wcmDevChangeControl(InputInfoPtr pInfo, xDeviceCtl * control)
@@ -861,6 +962,11 @@ static int wcmDevProc(DeviceIntPtr pWcm, int what)
 
 		case DEVICE_OFF:
 		case DEVICE_CLOSE:
+			/* the server disables a device before closing it, log
+			 * the stage counters only once */
+			if (what == DEVICE_OFF)
+				wcmLogStages(pInfo->private);
+			wcmTraceDump(((WacomDevicePtr)pInfo->private)->common);
 			wcmDisableTool(pWcm);
 			wcmUnlinkTouchAndPen(pInfo);
 			if (pInfo->fd >= 0)
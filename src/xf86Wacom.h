@@ -35,6 +35,7 @@
 #include <X11/Xatom.h>
 
 #include <wacom-util.h>
+#include <wacom-recorder.h>
 
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) < 18
 #define LogMessageVerbSigSafe xf86MsgVerb
@@ -115,8 +116,8 @@ char *wcmEventAutoDevProbe (InputInfoPtr pInfo);
 /* common tablet initialization regime */
 int wcmInitTablet(InputInfoPtr pInfo, const char* id, float version);
 
-/* standard packet handler */
-void wcmReadPacket(InputInfoPtr pInfo);
+/* standard packet handler, returns bytes read, 0 if none or -1 on error */
+int wcmReadPacket(InputInfoPtr pInfo);
 
 /* handles suppression, filtering, and dispatch. */
 void wcmEvent(WacomCommonPtr common, unsigned int channel, const WacomDeviceState* ds);
@@ -152,6 +153,19 @@ extern void wcmRotateTablet(InputInfoPtr pInfo, int value);
 extern void wcmRotateAndScaleCoordinates(InputInfoPtr pInfo, int* x, int* y);
 
 extern int wcmCheckPressureCurveValues(int x0, int y0, int x1, int y1);
+extern void wcmSetSuppress(WacomCommonPtr common, int level);
+extern uint64_t wcmTimeUs(void);
+extern uint64_t wcmTimeNs(void);
+extern void wcmRecordLatency(WacomDevicePtr priv, uint64_t time_us);
+extern void wcmGetStatistics(WacomDevicePtr priv, uint32_t *values);
+extern void wcmRecordRaw(WacomCommonPtr common, uint64_t time_us,
+			 const unsigned char *data, int len);
+extern void wcmRecordState(WacomCommonPtr common, int kind, int channel,
+			   const WacomDeviceState *ds);
+extern int wcmRecorderDump(WacomCommonPtr common);
+extern void wcmLogDeferred(WacomCommonPtr common, enum WacomLogId id,
+			   int a, int b, int c);
+extern void wcmLogFlush(WacomCommonPtr common);
 extern int wcmGetPhyDeviceID(WacomDevicePtr priv);
 
 /* device properties */
@@ -169,6 +183,11 @@ extern void set_absolute(InputInfoPtr pInfo, Bool absolute);
 extern WacomCommonPtr wcmRefCommon(WacomCommonPtr common);
 extern void wcmFreeCommon(WacomCommonPtr *common);
 extern WacomCommonPtr wcmNewCommon(void);
+extern Bool wcmAllocChannels(WacomCommonPtr common, int contacts);
+extern void wcmRebuildToolIndex(WacomCommonPtr common);
+extern void wcmInitStages(WacomDevicePtr priv);
+extern const char *wcmStageName(enum WacomStage stage);
+extern void wcmLogStages(WacomDevicePtr priv);
 extern void usbListModels(void);
 
 enum WacomSuppressMode {
@@ -190,8 +209,11 @@ enum WacomSuppressMode {
 /* For test suite */
 /* xf86Wacom.c */
 extern void wcmInitialToolSize(InputInfoPtr pInfo);
+extern void wcmParseBuffer(InputInfoPtr pInfo);
+extern void wcmAdjustReadBudget(WacomCommonPtr common, int reads);
 
 /* wcmConfig.c */
+extern int wcmAllocate(InputInfoPtr pInfo);
 extern int wcmSetType(InputInfoPtr pInfo, const char *type);
 
 /* wcmCommon.c */
@@ -202,9 +224,20 @@ extern int normalizePressure(const WacomDevicePtr priv, const int raw_pressure);
 extern enum WacomSuppressMode wcmCheckSuppress(WacomCommonPtr common,
 						const WacomDeviceState* dsOrig,
 						WacomDeviceState* dsNew);
+extern int wcmLatencyBucket(uint64_t latency_us);
+extern WacomToolPtr findTool(WacomCommonPtr common, const WacomDeviceState *ds);
+
+/* wcmRecorder.c */
+extern int wcmRecorderWrite(WacomCommonPtr common, int fd);
+
+/* wcmLog.c */
+extern CARD32 wcmLogFlushAt(WacomCommonPtr common, uint64_t now, Bool force);
 
 /* wcmUSB.c */
 extern int mod_buttons(int buttons, int btn, int state);
+extern int usbEventQueueSize(const unsigned long *abs, int contacts);
+extern int usbNextBit(const unsigned long *mask, int nbits, int from);
+extern int usbFirstClearBit(const unsigned long *mask, int nbits);
 #endif /* UNIT_TESTS */
 
 #endif /* __XF86WACOM_H */
@@ -24,6 +24,7 @@
  * General Defines
  ****************************************************************************/
 #include <wacom-util.h>
+#include <stdint.h>
 #include <asm/types.h>
 #include <linux/input.h>
 #define MAX_USB_EVENTS 32
@@ -37,11 +38,27 @@
 
 #define DEFAULT_SUPPRESS 2      /* default suppress */
 #define MAX_SUPPRESS 100        /* max value of suppress */
-#define BUFFER_SIZE 256         /* size of reception buffer */
+#define SUPPRESS_RESOLUTION 100000 /* points/m, one suppress step is 10um on x/y */
+#define BUFFER_SIZE 256         /* size of id/version buffers */
+#define RING_SIZE 4096          /* size of reception ring, power of two */
+#define RING_MASK (RING_SIZE - 1)
+#define MAX_PACKET_SIZE 32      /* largest packet a model parses at once */
+#define MIN_READ_BUDGET 2       /* min reads per wakeup in drain mode */
+#define DEFAULT_READ_BUDGET 8   /* initial reads per wakeup in drain mode */
+#define MAX_READ_BUDGET 64      /* max reads per wakeup in drain mode */
+#define LATENCY_BUCKETS 16      /* buckets in the event latency histogram */
+#define LATENCY_BUCKET_SHIFT 5  /* first bucket holds latencies < 32us */
 #define MAXTRY 3                /* max number of try to receive magic number */
 #define MIN_ROTATION  -900      /* the minimum value of the marker pen rotation */
 #define MAX_ROTATION_RANGE 1800 /* the maximum range of the marker pen rotation */
 #define MAX_ABS_WHEEL 1023      /* the maximum value of absolute wheel */
+#define TOOL_HASH_SIZE 64       /* buckets in the tool index, power of two */
+#define TOOL_TYPE_SLOTS 8       /* one default tool per DEVICE_ID bit */
+#define RECORDER_SIZE 32768     /* flight recorder entries, power of two, ~4 s at 1 kHz */
+#define RECORDER_DIR "/tmp"     /* default directory for flight recorder dumps */
+#define RECORDER_MAX_DUMPS 100  /* flight recorder dumps per second and tablet */
+#define LOG_FLUSH_DELAY 100     /* ms from the first deferred message to the log */
+#define LOG_RATE_LIMIT 1000     /* min ms between two lines of the same message */
 
 #define TILT_RES (180/M_PI)	/* Reported tilt resolution in points/radian
 				   (1/degree) */
@@ -121,10 +138,108 @@ struct _WacomModel
 	void (*GetResolution)(InputInfoPtr pInfo);
 	int (*GetRanges)(InputInfoPtr pInfo);
 	int (*Start)(InputInfoPtr pInfo);
+	/* Parse is handed a contiguous view of the reception ring. The view
+	 * holds at least min(available, MAX_PACKET_SIZE) bytes, but may be
+	 * shorter than the total amount of data available. Return the number
+	 * of bytes consumed, or 0 if more data is needed to make progress.
+	 * A parser returning 0 on a short view is called again with all of
+	 * the available data before the driver waits for more; a parser
+	 * must consume data from a full ring or the ring is flushed. */
 	int (*Parse)(InputInfoPtr pInfo, const unsigned char* data, int len);
 	int (*DetectConfig)(InputInfoPtr pInfo);
 };
 
+/******************************************************************************
+ * Event pipeline
+ *****************************************************************************/
+
+/* The stages wcmEvent runs a state through, in order. Each device only
+ * runs the stages that apply to its type, see wcmInitStages. */
+enum WacomStage {
+	STAGE_TILT2ROTATION,	/* Intuos4 mouse tilt to rotation */
+	STAGE_FILTER,		/* raw coordinate filter, see wcmFilterCoord */
+	STAGE_SUPPRESS,		/* see wcmCheckSuppress */
+	STAGE_HISTORY,		/* save the state in the channel history */
+	STAGE_ARBITRATE,	/* pointer control arbitration */
+	STAGE_GESTURE,		/* touch gestures, only the first finger goes on */
+	STAGE_SERIAL,		/* drop states for other tool serials */
+	STAGE_PREDICT,		/* pen position prediction, see wcmPredictCoord */
+	STAGE_PRESSURE,		/* pressure rebase and normalization */
+	STAGE_PRESSURE_BUTTON,	/* button 1 from pressure */
+	STAGE_PRESSURE_CURVE,	/* user pressure curve */
+	STAGE_CURSOR_PROX,	/* cursor hardware proximity tracking */
+	STAGE_RELATIVE,		/* relative mode motion suppression */
+	STAGE_PROXOUT,		/* cursor proximity by distance */
+	STAGE_SEND,		/* see wcmSendEvents */
+	STAGE_COUNT
+};
+
+typedef struct {
+	uint64_t events;	/* states that entered the stage */
+	uint64_t ns;		/* time spent in the stage, only with StageTiming */
+} WacomStageStats;
+
+/******************************************************************************
+ * Deferred logging
+ *****************************************************************************/
+
+/* Messages the input path doesn't log directly, see wcmLogDeferred */
+enum WacomLogId {
+	LOG_TOOL_NOT_INITIALIZED,
+	LOG_DEVICE_TYPE_MISMATCH,
+	LOG_EVENT_QUEUE_EXCEEDED,
+	LOG_INVALID_SERIAL,
+	LOG_REL_EVENT,
+	LOG_MISSING_HEADER,
+	LOG_BAD_DATA,
+	LOG_TOUCH_PARSE_FAILED,
+	LOG_COORD_PARSE_FAILED,
+	LOG_COUNT
+};
+
+#define LOG_ARGS 3
+
+typedef struct {
+	unsigned int pending;	/* occurrences since the last line */
+	int args[LOG_ARGS];	/* arguments of the first of them */
+	uint64_t last_us;	/* time of the last line */
+} WacomLogSlot;
+
+/******************************************************************************
+ * Statistics
+ *****************************************************************************/
+
+/* Counters exported through the Wacom Statistics property, in property
+ * order. The tablet-wide ones are kept on the common, the per-tool ones
+ * on the device, see wcmGetStatistics. The counters that wrap within days
+ * are 64 bit, a low word followed by a high word, see wcmStatAdd. */
+enum WacomStatistic {
+	STAT_BYTES_READ,	/* common: bytes read by wcmReadPacket, low word */
+	STAT_BYTES_READ_HIGH,	/* common: bytes read, high word */
+	STAT_FRAMES,		/* common: packets/frames handed to dispatch, low word */
+	STAT_FRAMES_HIGH,	/* common: packets/frames, high word */
+	STAT_FILTERED,		/* common: events dropped by the event map */
+	STAT_SUPPRESSED_ALL,	/* device: states discarded by wcmCheckSuppress */
+	STAT_SUPPRESSED_NON_MOTION, /* device: states reduced to motion */
+	STAT_ARBITRATION_LOST,	/* device: states denied pointer control */
+	STAT_CHANNEL_EXHAUSTED,	/* common: tools that found no free channel */
+	STAT_QUEUE_OVERFLOW,	/* common: frames that exceeded the event queue */
+	STAT_POSTED,		/* device: states posted to the server, low word */
+	STAT_POSTED_HIGH,	/* device: states posted, high word */
+	STAT_COUNT
+};
+
+#define STAT_IS_64BIT(stat) \
+	((stat) == STAT_BYTES_READ || (stat) == STAT_FRAMES || (stat) == STAT_POSTED)
+
+/* add n to the 64 bit counter starting at stats[stat] */
+#define wcmStatAdd(stats, stat, n) \
+	do { \
+		uint32_t _n = (n); \
+		if (((stats)[stat] += _n) < _n) \
+			(stats)[(stat) + 1]++; \
+	} while (0)
+
 /******************************************************************************
  * WacomDeviceRec
  *****************************************************************************/
@@ -209,36 +324,65 @@ struct _WacomModel
 /******************************************************************************
  * WacomDeviceState
  *****************************************************************************/
+/* The state is copied into every channel's history and through the whole
+ * event pipeline, so it is kept within one cache line. Fields are sized
+ * to the ranges real hardware reports, the ones touched on every event
+ * come first. */
 struct _WacomDeviceState
 {
-	InputInfoPtr pInfo;
-	int device_id;		/* tool id reported from the physical device */
-	int device_type;
-	unsigned int serial_num;
-	int x;
-	int y;
-	int buttons;
-	int pressure;
-	int tiltx;
-	int tilty;
-	int stripx;
-	int stripy;
-	int rotation;
-	int abswheel;
-	int abswheel2;
-	int relwheel;
-	int distance;
-	int throttle;
-	int proximity;
-	int sample;	/* wraps every 24 days */
-	int time;
+	uint64_t time_us;	/* kernel timestamp in microseconds */
+	int32_t x;
+	int32_t y;
+	int32_t pressure;
+	int32_t buttons;
+	uint8_t proximity;
+	uint8_t device_type;
+	int16_t tiltx;
+	int16_t tilty;
+	int16_t rotation;	/* -900..899 */
+	int16_t distance;
+	int16_t abswheel;	/* airbrush wheel, art pen, pad ring */
+	int16_t abswheel2;
+	int16_t relwheel;
+	int16_t throttle;	/* -1023..1023 */
+	int16_t stripx;
+	int16_t stripy;
+	int32_t device_id;	/* tool id reported from the physical device */
+	uint32_t serial_num;
+	int32_t sample;	/* ms, wraps every 24 days */
+	int32_t time;	/* ms, derived from time_us */
 };
 
+_Static_assert(sizeof(struct _WacomDeviceState) <= 64,
+	       "WacomDeviceState must fit into a cache line");
+
+/* Set the state's timestamp, the ms time is derived from it */
+#define TIME_US_TO_MS(us) ((int)((us) / 1000))
+#define wcmSetStateTime(ds, us) \
+	do { (ds)->time_us = (us); (ds)->time = TIME_US_TO_MS(us); } while (0)
+
 static const struct _WacomDeviceState OUTPROX_STATE = {
   .abswheel = MAX_PAD_RING + 1,
   .abswheel2 = MAX_PAD_RING + 1
 };
 
+/******************************************************************************
+ * Flight recorder
+ *****************************************************************************/
+
+/* An entry of the flight recorder ring, see wcmRecorder.c. Dumps use the
+ * fixed layout from wacom-recorder.h instead. */
+typedef struct {
+	uint64_t time_us;	/* monotonic time of the record, the event time of a state */
+	uint8_t kind;		/* enum wacom_recorder_kind */
+	uint16_t channel;	/* channel of a state record */
+	uint16_t len;		/* valid bytes in raw */
+	union {
+		WacomDeviceState state;
+		unsigned char raw[WACOM_RECORDER_RAW_SIZE];
+	} u;
+} WacomRecorderEntry;
+
 struct _WacomDeviceRec
 {
 	char *name;		/* Do not move, same offset as common->device_path. Used by DBG macro */
@@ -299,6 +443,20 @@ struct _WacomDeviceRec
 
 	int isParent;		/* set to 1 if the device is not auto-hotplugged */
 
+	/* kernel timestamp to xf86Post*Event latency, bucket n counts
+	 * latencies below 32us << n, the last bucket everything above.
+	 * Only written from the input path, read by the property code. */
+	uint32_t latency[LATENCY_BUCKETS];
+
+	/* per-tool counters, see enum WacomStatistic */
+	uint32_t stats[STAT_COUNT];
+
+	/* the stages this device's states go through, see wcmInitStages */
+	unsigned char stages[STAGE_COUNT];
+	int nstages;
+	Bool stageTiming;	/* also measure the time spent per stage */
+	WacomStageStats stageStats[STAGE_COUNT];
+
 	OsTimerPtr serial_timer; /* timer used for serial number property update */
 	OsTimerPtr tap_timer;   /* timer used for tap timing */
 	OsTimerPtr touch_timer; /* timer used for touch switch property update */
@@ -307,13 +465,45 @@ struct _WacomDeviceRec
 #define MAX_SAMPLES	20
 #define DEFAULT_SAMPLES 4
 
+/* The coordinate filters, see wcmFilterCoord. All of them smooth about as
+ * much as a sliding average over RawSample samples would. */
+enum WacomFilterMode {
+	FILTER_MODE_AVERAGE,	/* sliding average over RawSample samples */
+	FILTER_MODE_ONE_EURO,	/* low-pass with a speed adaptive cutoff */
+	FILTER_MODE_KALMAN,	/* constant velocity Kalman filter */
+	FILTER_MODE_COUNT
+};
+
+#define FILTER_INTERVAL		5000	/* us, assumed report interval */
+#define FILTER_MAX_INTERVAL	100000	/* us, longer gaps restart the filter */
+
+#define MAX_PREDICT		30	/* ms, longest prediction horizon */
+
+/* Per axis state of the One-Euro and Kalman filters, in 16.16 fixed
+ * point. The One-Euro filter only uses pos and vel. */
+typedef struct {
+	int64_t pos;		/* filtered position */
+	int64_t vel;		/* One-Euro: units/s, Kalman: units/ms */
+	int64_t p00, p01, p11;	/* Kalman error covariance */
+} WacomFilterAxis;
+
+/* The raw samples are a ring of the last window samples, head is the
+ * oldest one. The sums are kept up to date as samples are replaced so the
+ * average doesn't depend on the window size. */
 struct _WacomFilterState
 {
         int npoints;
+        int window;			/* wcmRawSample the ring was set up for */
+        int head;
         int x[MAX_SAMPLES];
         int y[MAX_SAMPLES];
         int tiltx[MAX_SAMPLES];
         int tilty[MAX_SAMPLES];
+        int sum_x, sum_y;
+        int sum_tiltx, sum_tilty;
+        int mode;			/* wcmFilterMode the state was set up for */
+        uint64_t time_us;		/* time of the last sample */
+        WacomFilterAxis axis[2];	/* x and y */
 };
 
 struct _WacomChannel
@@ -324,21 +514,28 @@ struct _WacomChannel
 	 * the work stage and the valid state. */
 
 	WacomDeviceState work;                         /* next state */
-	Bool dirty;
 
-	/* the following union contains the current known state of the
-	 * device channel, as well as the previous MAX_SAMPLES states
-	 * for use in detecting hardware defects, jitter, trends, etc. */
-	union
+	/* the following ring contains the current known state of the
+	 * device channel, as well as the previous MAX_SAMPLES - 1 states
+	 * for use in detecting hardware defects, jitter, trends, etc.
+	 * Access it through wcmChannelState(), never index it directly. */
+	struct
 	{
-		WacomDeviceState state;                /* current state */
-		WacomDeviceState states[MAX_SAMPLES];  /* states 0..MAX */
+		WacomDeviceState states[MAX_SAMPLES];  /* ring of states */
+		int head;                              /* index of the current state */
 	} valid;
 
 	int nSamples;
 	WacomFilterState rawFilter;
+	int predictX, predictY;	/* lead last added by wcmPredictCoord */
 };
 
+/* state of the channel age events ago, age 0 is the current state. Ages
+ * past the depth of the ring give the oldest state. */
+#define wcmChannelState(channel, age) \
+	(&(channel)->valid.states[((channel)->valid.head + MAX_SAMPLES - \
+		((age) < MAX_SAMPLES ? (age) : MAX_SAMPLES - 1)) % MAX_SAMPLES])
+
 /******************************************************************************
  * WacomDeviceClass
  *****************************************************************************/
@@ -360,9 +557,11 @@ extern WacomDeviceClass gWacomISDV4Device;
 
 #define TILT_ENABLED_FLAG       2
 
-#define MAX_FINGERS 16
-#define MAX_CHANNELS (MAX_FINGERS+2) /* one channel for stylus/mouse. The other one for pad */
-#define PAD_CHANNEL (MAX_CHANNELS-1)
+/* wcmChannel holds one channel per contact, one for stylus/mouse and the
+ * last one for pad, see wcmAllocChannels */
+#define MIN_CONTACTS 2
+#define MAX_CONTACTS 256
+#define PAD_CHANNEL(common) ((common)->wcmChannelCnt - 1)
 
 typedef struct {
 	int wcmZoomDistance;	       /* minimum distance for a zoom touch gesture */
@@ -379,6 +578,21 @@ enum WacomProtocol {
 	WCM_PROTOCOL_5
 };
 
+/* Axes with their own suppress threshold, in the order of the
+ * "Wacom Sample and Suppress" property values after suppress and sample */
+enum WacomSuppressAxis {
+	SUPPRESS_AXIS_X,
+	SUPPRESS_AXIS_Y,
+	SUPPRESS_AXIS_TOUCH_X,
+	SUPPRESS_AXIS_TOUCH_Y,
+	SUPPRESS_AXIS_PRESSURE,
+	SUPPRESS_AXIS_TILT,
+	SUPPRESS_AXIS_ROTATION,
+	SUPPRESS_AXIS_WHEEL,
+	SUPPRESS_AXIS_THROTTLE,
+	SUPPRESS_AXIS_COUNT
+};
+
 struct _WacomDriverRec
 {
 	WacomDevicePtr active;     /* Arbitrate motion through this pointer */
@@ -443,7 +657,10 @@ struct _WacomCommonRec
 	float wcmVersion;            /* ROM version */
 	int wcmRotate;               /* rotate screen (for TabletPC) */
 	int wcmThreshold;            /* Threshold for button pressure */
-	WacomChannel wcmChannel[MAX_CHANNELS]; /* channel device state */
+	int wcmChannelCnt;           /* number of channels in wcmChannel */
+	WacomChannel *wcmChannel;    /* channel device state */
+	unsigned long *wcmDirtyChannels; /* channels with new work state */
+	unsigned long *wcmBusyChannels;  /* channels handed out by the backend */
 
 	WacomDeviceClassPtr wcmDevCls; /* device class functions */
 	WacomModelPtr wcmModel;        /* model-specific functions */
@@ -453,24 +670,59 @@ struct _WacomCommonRec
 	int wcmGesture;	     	     /* disable/enable touch gesture */
 	int wcmGestureDefault;       /* default touch gesture to disable when not supported */
 	int wcmGestureMode;	       /* data is in Gesture Mode? */
-	WacomDeviceState wcmGestureState[MAX_FINGERS]; /* inital state when in gesture mode */
+	WacomDeviceState wcmGestureState[2]; /* inital state when in gesture mode */
 	WacomGesturesParameters wcmGestureParameters;
 	int wcmMaxCursorDist;	     /* Max mouse distance reported so far */
 	int wcmCursorProxoutDist;    /* Max mouse distance for proxy-out max/256 units */
 	int wcmCursorProxoutDistDefault; /* Default max mouse distance for proxy-out */
 	int wcmSuppress;        	 /* transmit position on delta > supress */
+	int wcmSuppressAxis[SUPPRESS_AXIS_COUNT]; /* per-axis thresholds derived
+						     from wcmSuppress */
 	int wcmRawSample;	     /* Number of raw data used to filter an event */
+	int wcmFilterMode;	     /* enum WacomFilterMode */
+	int wcmPredict;		     /* pen prediction horizon in ms, 0 is off */
 	int wcmPressureRecalibration; /* Determine if pressure recalibration of
 					 worn pens should be performed */
 
-	int bufpos;                        /* position with buffer */
-	unsigned char buffer[BUFFER_SIZE]; /* data read from device */
+	/* Reception ring. head and tail are free-running, data between them
+	 * is unparsed. The area past the end of the ring mirrors its start
+	 * so a packet or frame spanning the wrap can be parsed in place. */
+	unsigned int head;                 /* write index into ring */
+	unsigned int tail;                 /* read index into ring */
+	unsigned char buffer[2 * RING_SIZE]; /* data read from device */
+	Bool wcmReadDrain;           /* fd is non-blocking, read until EAGAIN */
+	int wcmReadBudget;           /* current max reads per wakeup */
+	unsigned int wcmReadBudgetExhausted; /* wakeups that ran out of budget */
+	uint32_t wcmStats[STAT_COUNT]; /* tablet-wide counters, see enum WacomStatistic */
+
+	/* tracepoint records, see wcmTrace.h */
+	int wcmTraceMask;            /* enabled TRACE_* categories */
+	struct _WacomTraceRecord *wcmTraceRing; /* TRACE_RING_SIZE records */
+	unsigned int wcmTraceHead;   /* free-running write index */
+	unsigned int wcmTraceDumped; /* head at the last wcmTraceDump */
+
+	/* flight recorder, see wcmRecorder.c */
+	WacomRecorderEntry *wcmRecorder; /* RECORDER_SIZE entries */
+	unsigned int wcmRecorderHead; /* free-running write index */
+	char *wcmRecorderDir;        /* where dumps are written */
+
+	/* messages from the input path, see wcmLogDeferred */
+	WacomLogSlot wcmLog[LOG_COUNT];
+	OsTimerPtr wcmLogTimer;      /* flushes wcmLog */
+	Bool wcmLogArmed;            /* wcmLogTimer is pending */
 
 	void *private;		     /* backend-specific information */
 
 	WacomToolPtr wcmTool; /* List of unique tools */
 	WacomToolPtr serials; /* Serial numbers provided at startup*/
 
+	/* findTool index over wcmTool, see wcmRebuildToolIndex */
+	WacomToolPtr wcmToolHash[TOOL_HASH_SIZE]; /* serial-bound tools by (type, serial) */
+	WacomToolPtr wcmToolDefault[TOOL_TYPE_SLOTS]; /* serial 0 tool per type */
+	WacomToolPtr wcmLastTool;    /* result of the last lookup */
+	int wcmLastToolType;         /* device type of the last lookup */
+	unsigned int wcmLastToolSerial; /* serial of the last lookup */
+
 	/* DO NOT TOUCH THIS. use wcmRefCommon() instead */
 	int refcnt;			/* number of devices sharing this struct */
 
@@ -487,6 +739,7 @@ struct _WacomCommonRec
 struct _WacomTool
 {
 	WacomToolPtr next; /* Next tool in list */
+	WacomToolPtr hash_next; /* Next tool in the same common->wcmToolHash bucket */
 
 	int typeid; /* Tool type */
 	unsigned int serial; /* Serial id, 0 == no serial id */
@@ -0,0 +1,999 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Offline benchmark of the USB event path. A recorded evdev stream is fed
+ * through the model's Parse callback (usbParse -> usbParseSynEvent ->
+ * usbDispatchEvents -> wcmEvent -> wcmSendEvents) with the server
+ * symbols stubbed out by fake-symbols.c, and the time spent per frame is
+ * reported.
+ *
+ * The driver's ioctl() calls on the replayed device are answered from the
+ * capture header and the replayed event state, see wcm_replay_ioctl().
+ * Captures are created with --record, see wacom-replay.h for the format.
+ *
+ * With --predict the pen positions of one more pass are run through
+ * wcmPredictCoord and compared to where the pen really was that much
+ * later, to tune the prediction offline.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fake-symbols.h"
+#include <xf86Wacom.h>
+#include "wcmFilter.h"
+#include "wacom-replay.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/input.h>
+#include <linux/version.h>
+
+#define DEFAULT_ITERATIONS 10
+#define MAX_SLOTS 64
+
+#ifndef SYN_DROPPED
+#define SYN_DROPPED 3
+#endif
+
+/* Same as the private defaults in wcmValidateDevice.c */
+#define WCM_BAMBOO3_MAXX 4096.0
+#define WCM_BAMBOO3_ZOOM_DISTANCE 180.0
+#define WCM_BAMBOO3_SCROLL_DISTANCE 80.0
+#define WCM_BAMBOO3_SCROLL_SPREAD_DISTANCE 350.0
+
+static struct {
+	int fd;				/* fd handed to the driver */
+	struct wcm_replay_header header;
+	unsigned long keys[NBITS(KEY_MAX)];	/* current EVIOCGKEY state */
+	int abs[WCM_REPLAY_ABS_COUNT];		/* current EVIOCGABS values */
+	int mt[MAX_SLOTS][WCM_REPLAY_ABS_COUNT - ABS_MT_SLOT]; /* EVIOCGMTSLOTS */
+	unsigned long nioctls;		/* ioctls issued by the driver */
+} replay = { .fd = -1 };
+
+static volatile sig_atomic_t stop_recording;
+
+/*****************************************************************************
+ * Fake evdev device
+ ****************************************************************************/
+
+static int copy_bits(void *dest, size_t size, const uint8_t *bits, size_t len)
+{
+	memset(dest, 0, size);
+	len = min(size, len);
+	if (len)
+		memcpy(dest, bits, len);
+	return len;
+}
+
+static int wcm_replay_ioctl(unsigned long request, void *arg)
+{
+	unsigned int nr = _IOC_NR(request);
+	unsigned int size = _IOC_SIZE(request);
+	const struct wcm_replay_header *h = &replay.header;
+
+	if (_IOC_TYPE(request) != 'E')
+		goto invalid;
+
+	if (request == EVIOCGVERSION)
+	{
+		*(int*)arg = EV_VERSION;
+		return 0;
+	}
+	else if (request == EVIOCGID)
+	{
+		struct input_id *id = arg;
+
+		id->bustype = h->bustype;
+		id->vendor = h->vendor;
+		id->product = h->product;
+		id->version = h->id_version;
+		return 0;
+	}
+	else if (request == EVIOCGRAB)
+		return 0;
+
+	if (_IOC_DIR(request) != _IOC_READ)
+		goto invalid;
+
+	if (nr >= _IOC_NR(EVIOCGABS(0)) &&
+	    nr < _IOC_NR(EVIOCGABS(WCM_REPLAY_ABS_COUNT)))
+	{
+		int code = nr - _IOC_NR(EVIOCGABS(0));
+		const struct wcm_replay_absinfo *a = &h->absinfo[code];
+		struct input_absinfo *absinfo = arg;
+
+		if (!(h->absbits[code / 8] & (1 << (code % 8))))
+			goto invalid;
+
+		absinfo->value = replay.abs[code];
+		absinfo->minimum = a->minimum;
+		absinfo->maximum = a->maximum;
+		absinfo->fuzz = a->fuzz;
+		absinfo->flat = a->flat;
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2,6,30)
+		absinfo->resolution = a->resolution;
+#endif
+		return 0;
+	}
+
+	if (nr == _IOC_NR(EVIOCGBIT(0, 0)))
+		return copy_bits(arg, size, h->evbits, sizeof(h->evbits));
+	else if (nr == _IOC_NR(EVIOCGBIT(EV_KEY, 0)))
+		return copy_bits(arg, size, h->keybits, sizeof(h->keybits));
+	else if (nr == _IOC_NR(EVIOCGBIT(EV_ABS, 0)))
+		return copy_bits(arg, size, h->absbits, sizeof(h->absbits));
+	else if (nr == _IOC_NR(EVIOCGBIT(EV_SW, 0)))
+		return copy_bits(arg, size, h->swbits, sizeof(h->swbits));
+	else if (nr >= _IOC_NR(EVIOCGBIT(0, 0)) &&
+		 nr < _IOC_NR(EVIOCGBIT(EV_CNT, 0)))
+		return copy_bits(arg, size, NULL, 0);
+	else if (nr == _IOC_NR(EVIOCGNAME(0)))
+		return copy_bits(arg, size, (const uint8_t*)h->name,
+				 strnlen(h->name, sizeof(h->name) - 1) + 1);
+	else if (nr == _IOC_NR(EVIOCGKEY(0)))
+		return copy_bits(arg, size, (const uint8_t*)replay.keys,
+				 sizeof(replay.keys));
+	else if (nr == _IOC_NR(EVIOCGSW(0)))
+		return copy_bits(arg, size, NULL, 0);
+#ifdef EVIOCGMTSLOTS
+	else if (nr == _IOC_NR(EVIOCGMTSLOTS(0)))
+	{
+		int32_t *values = arg;
+		int code = values[0];
+		int i, nslots = min(size / sizeof(int32_t) - 1, MAX_SLOTS);
+
+		if (code <= ABS_MT_SLOT || code >= WCM_REPLAY_ABS_COUNT ||
+		    !(h->absbits[code / 8] & (1 << (code % 8))))
+			goto invalid;
+
+		for (i = 0; i < nslots; i++)
+			values[1 + i] = replay.mt[i][code - ABS_MT_SLOT];
+		return 0;
+	}
+#endif
+#ifdef EVIOCGPROP
+	else if (nr == _IOC_NR(EVIOCGPROP(0)))
+		return copy_bits(arg, size, h->propbits, sizeof(h->propbits));
+#endif
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Overrides the libc ioctl() for the whole binary, including the driver
+ * code. Anything not aimed at the replayed device goes to the kernel. */
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	void *arg;
+
+	va_start(args, request);
+	arg = va_arg(args, void*);
+	va_end(args);
+
+	if (fd < 0 || fd != replay.fd)
+		return syscall(SYS_ioctl, fd, request, arg);
+
+	replay.nioctls++;
+	return wcm_replay_ioctl(request, arg);
+}
+
+/* Update the state the fake device reports through EVIOCGKEY/EVIOCGABS */
+static void wcm_replay_update_state(const struct input_event *ev, int count)
+{
+	for (; count > 0; count--, ev++)
+	{
+		if (ev->type == EV_KEY && ev->code <= KEY_MAX)
+		{
+			if (ev->value)
+				SETBIT(replay.keys, ev->code);
+			else
+				CLEARBIT(replay.keys, ev->code);
+		}
+		else if (ev->type == EV_ABS && ev->code < WCM_REPLAY_ABS_COUNT)
+		{
+			int slot = replay.abs[ABS_MT_SLOT];
+
+			replay.abs[ev->code] = ev->value;
+			if (ev->code > ABS_MT_SLOT && slot >= 0 && slot < MAX_SLOTS)
+				replay.mt[slot][ev->code - ABS_MT_SLOT] = ev->value;
+		}
+	}
+}
+
+/*****************************************************************************
+ * Capture files
+ ****************************************************************************/
+
+static struct input_event* wcm_replay_load(const char *path, int *nevents)
+{
+	struct wcm_replay_header *h = &replay.header;
+	struct wcm_replay_event rec;
+	struct input_event *events = NULL;
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fread(h, sizeof(*h), 1, fp) != 1 ||
+	    memcmp(h->magic, WCM_REPLAY_MAGIC, sizeof(h->magic)) != 0)
+	{
+		fprintf(stderr, "%s: not a wacom capture file\n", path);
+		goto error;
+	}
+
+	if (h->version != WCM_REPLAY_VERSION || h->header_size < sizeof(*h))
+	{
+		fprintf(stderr, "%s: unsupported capture version %u\n",
+			path, h->version);
+		goto error;
+	}
+
+	if (fseek(fp, h->header_size, SEEK_SET) != 0)
+		goto truncated;
+
+	h->name[sizeof(h->name) - 1] = '\0';
+	for (i = 0; i < WCM_REPLAY_ABS_COUNT; i++)
+		replay.abs[i] = h->absinfo[i].value;
+	for (i = 0; i < MAX_SLOTS; i++)
+		replay.mt[i][ABS_MT_TRACKING_ID - ABS_MT_SLOT] = -1;
+
+	events = calloc(h->nevents, sizeof(*events));
+	if (!events && h->nevents)
+		goto truncated;
+
+	for (i = 0; i < h->nevents; i++)
+	{
+		if (fread(&rec, sizeof(rec), 1, fp) != 1)
+			goto truncated;
+
+		events[i].time.tv_sec = rec.sec;
+		events[i].time.tv_usec = rec.usec;
+		events[i].type = rec.type;
+		events[i].code = rec.code;
+		events[i].value = rec.value;
+	}
+
+	fclose(fp);
+	*nevents = h->nevents;
+	return events;
+
+truncated:
+	fprintf(stderr, "%s: truncated capture file\n", path);
+error:
+	free(events);
+	fclose(fp);
+	return NULL;
+}
+
+static void record_sigint(int sig)
+{
+	stop_recording = 1;
+}
+
+static int wcm_replay_record(const char *device, const char *path, long count)
+{
+	struct wcm_replay_header h = {{0}};
+	struct input_id id;
+	struct input_event ev;
+	FILE *fp;
+	int fd, i;
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", device, strerror(errno));
+		return 1;
+	}
+
+	memcpy(h.magic, WCM_REPLAY_MAGIC, sizeof(h.magic));
+	h.version = WCM_REPLAY_VERSION;
+	h.header_size = sizeof(h);
+
+	if (ioctl(fd, EVIOCGID, &id) < 0 ||
+	    ioctl(fd, EVIOCGNAME(sizeof(h.name) - 1), h.name) < 0 ||
+	    ioctl(fd, EVIOCGBIT(0, sizeof(h.evbits)), h.evbits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(h.keybits)), h.keybits) < 0 ||
+	    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(h.absbits)), h.absbits) < 0)
+	{
+		fprintf(stderr, "%s: not an evdev device\n", device);
+		close(fd);
+		return 1;
+	}
+
+	h.bustype = id.bustype;
+	h.vendor = id.vendor;
+	h.product = id.product;
+	h.id_version = id.version;
+	ioctl(fd, EVIOCGBIT(EV_SW, sizeof(h.swbits)), h.swbits);
+#ifdef EVIOCGPROP
+	ioctl(fd, EVIOCGPROP(sizeof(h.propbits)), h.propbits);
+#endif
+
+	for (i = 0; i < WCM_REPLAY_ABS_COUNT; i++)
+	{
+		struct input_absinfo absinfo = {0};
+
+		if (!(h.absbits[i / 8] & (1 << (i % 8))))
+			continue;
+
+		if (ioctl(fd, EVIOCGABS(i), &absinfo) < 0)
+			continue;
+
+		h.absinfo[i].value = absinfo.value;
+		h.absinfo[i].minimum = absinfo.minimum;
+		h.absinfo[i].maximum = absinfo.maximum;
+		h.absinfo[i].fuzz = absinfo.fuzz;
+		h.absinfo[i].flat = absinfo.flat;
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2,6,30)
+		h.absinfo[i].resolution = absinfo.resolution;
+#endif
+	}
+
+	fp = fopen(path, "wb");
+	if (!fp || fwrite(&h, sizeof(h), 1, fp) != 1)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	fprintf(stderr, "Recording '%s', press Ctrl+C to stop.\n", h.name);
+	signal(SIGINT, record_sigint);
+
+	while (!stop_recording && (count <= 0 || h.nevents < count) &&
+	       read(fd, &ev, sizeof(ev)) == sizeof(ev))
+	{
+		struct wcm_replay_event rec;
+
+		rec.sec = ev.time.tv_sec;
+		rec.usec = ev.time.tv_usec;
+		rec.type = ev.type;
+		rec.code = ev.code;
+		rec.value = ev.value;
+
+		if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+			break;
+		h.nevents++;
+	}
+
+	/* the event count is only known now */
+	rewind(fp);
+	fwrite(&h, sizeof(h), 1, fp);
+	fclose(fp);
+	close(fd);
+
+	fprintf(stderr, "%u events written to %s\n", h.nevents, path);
+	return 0;
+}
+
+/*****************************************************************************
+ * Driver setup
+ ****************************************************************************/
+
+static Bool wcm_replay_has_key(int code)
+{
+	return !!(replay.header.keybits[code / 8] & (1 << (code % 8)));
+}
+
+/* The key check of wcmIsAValidType, without the user-defined type
+ * fallback */
+static Bool wcm_replay_has_type(const char *type)
+{
+	Bool generic = !(replay.header.absbits[ABS_MISC / 8] &
+			 (1 << (ABS_MISC % 8)));
+
+	if (!strcmp(type, "stylus"))
+		return wcm_replay_has_key(BTN_TOOL_PEN);
+	else if (!strcmp(type, "eraser"))
+		return wcm_replay_has_key(BTN_TOOL_RUBBER);
+	else if (!strcmp(type, "cursor"))
+		return wcm_replay_has_key(BTN_TOOL_MOUSE);
+	else if (!strcmp(type, "touch"))
+		return wcm_replay_has_key(BTN_TOOL_DOUBLETAP) ||
+			(generic && wcm_replay_has_key(BTN_TOOL_FINGER));
+	else if (!strcmp(type, "pad"))
+		return wcm_replay_has_key(BTN_FORWARD) ||
+			wcm_replay_has_key(BTN_0);
+	return FALSE;
+}
+
+/**
+ * Set up one tool the way wcmPreInit and wcmDevInit would with an empty
+ * option list. The first device allocates the common struct, all others
+ * share it.
+ */
+static InputInfoPtr wcm_replay_add_device(InputInfoPtr parent,
+					  const char *path, const char *type)
+{
+	InputInfoPtr pInfo;
+	WacomDevicePtr priv;
+	WacomCommonPtr common;
+	DeviceIntPtr dev;
+	char id[BUFFER_SIZE];
+	float version;
+
+	pInfo = calloc(1, sizeof(*pInfo));
+	dev = calloc(1, sizeof(*dev));
+	if (!pInfo || !dev)
+		return NULL;
+
+	dev->valuator = calloc(1, sizeof(*dev->valuator));
+	if (!dev->valuator)
+		return NULL;
+	dev->valuator->axes = calloc(MAX_VALUATORS, sizeof(AxisInfo));
+	if (!dev->valuator->axes)
+		return NULL;
+	dev->public.devicePrivate = pInfo;
+
+	if (asprintf(&pInfo->name, "%s %s", replay.header.name, type) < 0)
+		return NULL;
+	pInfo->fd = replay.fd;
+	pInfo->dev = dev;
+
+	if (!wcmAllocate(pInfo))
+		return NULL;
+
+	priv = pInfo->private;
+	priv->name = pInfo->name;
+
+	if (parent)
+	{
+		/* share the parent's common struct, like wcmMatchDevice */
+		WacomDevicePtr parent_priv = parent->private;
+		WacomToolPtr tool;
+
+		wcmFreeCommon(&priv->common);
+		priv->common = wcmRefCommon(parent_priv->common);
+		priv->next = priv->common->wcmDevices;
+		priv->common->wcmDevices = priv;
+
+		for (tool = priv->common->wcmTool; tool->next; tool = tool->next)
+			;
+		tool->next = priv->tool;
+	}
+	else
+	{
+		priv->common->device_path = strdup(path);
+		priv->common->wcmDevCls = &gWacomUSBDevice;
+		wcmDeviceTypeKeys(pInfo);
+	}
+	common = priv->common;
+
+	if (!wcmSetType(pInfo, type))
+		return NULL;
+
+	/* wcmPreInitParseOptions defaults */
+	if (IsPad(priv))
+		set_absolute(pInfo, TRUE);
+
+	wcmSetPressureCurve(priv, 0, 0, 100, 100);
+
+	if (TabletHasFeature(common, WCM_1FGT) ||
+	    TabletHasFeature(common, WCM_2FGT))
+	{
+		common->wcmTouchDefault = common->wcmTouch = 1;
+		common->wcmMaxContacts = TabletHasFeature(common, WCM_1FGT) ? 1 : 2;
+	}
+
+	if (TabletHasFeature(common, WCM_2FGT))
+		common->wcmGestureDefault = common->wcmGesture = 1;
+
+	if (IsStylus(priv) || IsEraser(priv))
+		common->wcmPressureRecalibration = 1;
+
+	/* wcmInitModel */
+	if (common->wcmDevCls->Init(pInfo, id, ARRAY_SIZE(id), &version) != Success ||
+	    wcmInitTablet(pInfo, id, version) != Success)
+		return NULL;
+
+	/* wcmPostInitParseOptions defaults */
+	if (TabletHasFeature(common, WCM_2FGT) && IsTouch(priv))
+	{
+		common->wcmGestureParameters.wcmZoomDistance =
+			common->wcmMaxTouchX *
+			(WCM_BAMBOO3_ZOOM_DISTANCE / WCM_BAMBOO3_MAXX);
+		common->wcmGestureParameters.wcmScrollDistance =
+			common->wcmMaxTouchX *
+			(WCM_BAMBOO3_SCROLL_DISTANCE / WCM_BAMBOO3_MAXX);
+		common->wcmGestureParameters.wcmMaxScrollFingerSpread =
+			common->wcmMaxTouchX *
+			(WCM_BAMBOO3_SCROLL_SPREAD_DISTANCE / WCM_BAMBOO3_MAXX);
+	}
+	wcmSetSuppress(common, common->wcmSuppress);
+
+	/* wcmPreInit */
+	wcmInitStages(priv);
+
+	if (IsTouch(priv))
+		common->wcmTouchDevice = priv;
+
+	/* wcmDevInit */
+	if (common->wcmModel->DetectConfig)
+		common->wcmModel->DetectConfig(pInfo);
+
+	if (IsPad(priv) && TabletHasFeature(common, WCM_DUALRING))
+		priv->naxes++;
+
+	if (!IsPad(priv))
+	{
+		wcmInitialToolSize(pInfo);
+
+		if (is_absolute(pInfo))
+		{
+			dev->valuator->axes[0].min_value = priv->topX;
+			dev->valuator->axes[0].max_value = priv->bottomX;
+			dev->valuator->axes[1].min_value = priv->topY;
+			dev->valuator->axes[1].max_value = priv->bottomY;
+		}
+	}
+	dev->valuator->numAxes = priv->naxes;
+
+	InitWcmDeviceProperties(pInfo);
+
+	return pInfo;
+}
+
+static InputInfoPtr wcm_replay_init(const char *path)
+{
+	static const char *types[] = { "stylus", "eraser", "cursor", "touch", "pad" };
+	InputInfoPtr first = NULL;
+	int i;
+
+	replay.fd = open("/dev/null", O_RDONLY);
+	if (replay.fd < 0)
+		return NULL;
+
+	for (i = 0; i < ARRAY_SIZE(types); i++)
+	{
+		InputInfoPtr pInfo;
+
+		if (!wcm_replay_has_type(types[i]))
+			continue;
+
+		pInfo = wcm_replay_add_device(first, path, types[i]);
+		if (!pInfo)
+		{
+			fprintf(stderr, "%s: failed to set up the %s device\n",
+				path, types[i]);
+			return NULL;
+		}
+
+		if (!first)
+			first = pInfo;
+	}
+
+	if (!first)
+		fprintf(stderr, "%s: no supported tools on this device\n", path);
+	else if (((WacomDevicePtr)first->private)->common->wcmModel->Start)
+	{
+		/* wcmDevOpen */
+		WacomCommonPtr common = ((WacomDevicePtr)first->private)->common;
+
+		if (common->wcmModel->Start(first) != Success)
+			return NULL;
+	}
+
+	return first;
+}
+
+/*****************************************************************************
+ * Benchmark
+ ****************************************************************************/
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t *sorted, size_t n, double p)
+{
+	size_t idx = (size_t)(p / 100.0 * (n - 1) + 0.5);
+
+	return sorted[min(idx, n - 1)] / 1000.0;
+}
+
+/* Split the stream into frames, each ending with a SYN_REPORT. Returns
+ * the number of frames, frames[i] is the index of the first event after
+ * frame i. */
+static int split_frames(const struct input_event *events, int nevents,
+			int *frames)
+{
+	int i, nframes = 0;
+
+	for (i = 0; i < nevents; i++)
+		if (events[i].type == EV_SYN && events[i].code == SYN_REPORT)
+			frames[nframes++] = i + 1;
+
+	if (!nframes || frames[nframes - 1] != nevents)
+		frames[nframes++] = nevents;
+
+	return nframes;
+}
+
+/* Feed a frame through the reception ring the way wcmReadPacket does */
+static void replay_frame(InputInfoPtr pInfo, const struct input_event *events,
+			 int count)
+{
+	WacomDevicePtr priv = (WacomDevicePtr)pInfo->private;
+	WacomCommonPtr common = priv->common;
+	const unsigned char *data = (const unsigned char*)events;
+	unsigned int len = count * sizeof(*events);
+
+	while (len > 0)
+	{
+		unsigned int pos = common->head & RING_MASK;
+		unsigned int n = RING_SIZE - (common->head - common->tail);
+
+		n = min(n, RING_SIZE - pos);
+		n = min(n, len);
+
+		memcpy(common->buffer + pos, data, n);
+		common->head += n;
+		data += n;
+		len -= n;
+
+		wcmParseBuffer(pInfo);
+	}
+}
+
+/*****************************************************************************
+ * Prediction error
+ ****************************************************************************/
+
+struct predict_sample {
+	uint64_t time_us;
+	int channel;
+	Bool proximity;
+	Bool predicted;
+	int x, y;		/* position in the channel history */
+	int px, py;		/* predicted position */
+};
+
+/* Position of the pen on channel s->channel at time t, interpolated from
+ * the samples after s. FALSE if the pen left proximity before. */
+static Bool pen_position_at(const struct predict_sample *s,
+			    const struct predict_sample *end, uint64_t t,
+			    double *x, double *y)
+{
+	const struct predict_sample *prev = s;
+
+	for (s++; s < end; s++)
+	{
+		double f;
+
+		if (s->channel != prev->channel)
+			continue;
+		if (!s->proximity)
+			return FALSE;
+		if (s->time_us < t)
+		{
+			prev = s;
+			continue;
+		}
+
+		f = (double)(t - prev->time_us) / (s->time_us - prev->time_us);
+		*x = prev->x + f * (s->x - prev->x);
+		*y = prev->y + f * (s->y - prev->y);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * Replay the capture once more, predict every pen state horizon ms ahead
+ * and print how far off the prediction was, next to how far the pen got
+ * in that time, i.e. the error without prediction.
+ */
+static int report_prediction(InputInfoPtr pInfo, const struct input_event *events,
+			     const int *frames, int nframes, int horizon)
+{
+	WacomDevicePtr priv = pInfo->private;
+	WacomCommonPtr common = priv->common;
+	struct predict_sample *samples;
+	uint64_t *last, *error, *baseline;
+	double mm = common->wcmResolX ? 1000.0 / common->wcmResolX : 0;
+	size_t nsamples = 0, npredicted = 0, n = 0, i;
+	int f, c, e;
+
+	samples = calloc((size_t)nframes * common->wcmChannelCnt, sizeof(*samples));
+	last = calloc(common->wcmChannelCnt, sizeof(*last));
+	error = calloc((size_t)nframes * common->wcmChannelCnt, sizeof(*error));
+	baseline = calloc((size_t)nframes * common->wcmChannelCnt, sizeof(*baseline));
+	if (!samples || !last || !error || !baseline)
+		return 1;
+
+	for (f = 0, e = 0; f < nframes; e = frames[f++])
+	{
+		wcm_replay_update_state(events + e, frames[f] - e);
+		replay_frame(pInfo, events + e, frames[f] - e);
+
+		for (c = 0; c < common->wcmChannelCnt; c++)
+		{
+			WacomChannelPtr channel = &common->wcmChannel[c];
+			WacomDeviceState ds = *wcmChannelState(channel, 0);
+			struct predict_sample *s = &samples[nsamples];
+
+			if ((ds.device_type != STYLUS_ID && ds.device_type != ERASER_ID) ||
+			    ds.time_us == last[c])
+				continue;
+			last[c] = ds.time_us;
+
+			s->time_us = ds.time_us;
+			s->channel = c;
+			s->proximity = ds.proximity;
+			s->x = ds.x;
+			s->y = ds.y;
+			s->predicted = wcmPredictCoord(common, channel, &ds,
+						       horizon * 1000);
+			s->px = ds.x;
+			s->py = ds.y;
+			nsamples++;
+		}
+	}
+
+	/* errors in 1/1000 units, so percentile() reports units */
+	for (i = 0; i < nsamples; i++)
+	{
+		const struct predict_sample *s = &samples[i];
+		double x, y;
+
+		if (!s->proximity ||
+		    !pen_position_at(s, samples + nsamples,
+				     s->time_us + horizon * 1000, &x, &y))
+			continue;
+
+		error[n] = 1000 * hypot(s->px - x, s->py - y);
+		baseline[n] = 1000 * hypot(s->x - x, s->y - y);
+		npredicted += s->predicted;
+		n++;
+	}
+
+	if (!n)
+	{
+		printf("prediction:  no pen strokes in this capture\n");
+		goto out;
+	}
+
+	qsort(error, n, sizeof(*error), cmp_u64);
+	qsort(baseline, n, sizeof(*baseline), cmp_u64);
+
+	printf("prediction:  %d ms ahead, %zu of %zu pen states predicted\n",
+	       horizon, npredicted, n);
+	printf("  error      p50 %.1f, p90 %.1f, max %.1f units (p90 %.2f mm)\n",
+	       percentile(error, n, 50), percentile(error, n, 90),
+	       error[n - 1] / 1000.0, percentile(error, n, 90) * mm);
+	printf("  without    p50 %.1f, p90 %.1f, max %.1f units (p90 %.2f mm)\n",
+	       percentile(baseline, n, 50), percentile(baseline, n, 90),
+	       baseline[n - 1] / 1000.0, percentile(baseline, n, 90) * mm);
+
+out:
+	free(baseline);
+	free(error);
+	free(last);
+	free(samples);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <capture>\n"
+		"       %s --record <device> <capture> [count]\n"
+		"\n"
+		"Options:\n"
+		"  -n, --iterations=N   replay the capture N times (default %d)\n"
+		"  -d, --drop=N         precede every Nth frame with a SYN_DROPPED\n"
+		"  -s, --stages         time the event pipeline stages and print them\n"
+		"  -p, --predict=MS     measure the error of a pen prediction MS ahead\n"
+		"  -r, --record         record a capture from an evdev device\n"
+		"  -h, --help           this help\n",
+		name, name, DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "iterations", required_argument, NULL, 'n' },
+		{ "drop", required_argument, NULL, 'd' },
+		{ "stages", no_argument, NULL, 's' },
+		{ "predict", required_argument, NULL, 'p' },
+		{ "record", no_argument, NULL, 'r' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct input_event *events;
+	InputInfoPtr pInfo;
+	uint64_t *samples, total = 0;
+	int *frames;
+	int nevents, nframes, iterations = DEFAULT_ITERATIONS, drop = 0;
+	struct input_event dropped = { .type = EV_SYN, .code = SYN_DROPPED };
+	int record = 0, stages = 0, predict = 0;
+	int c, i, f;
+	size_t nsamples = 0;
+
+	while ((c = getopt_long(argc, argv, "n:d:sp:rh", options, NULL)) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'd':
+				drop = atoi(optarg);
+				break;
+			case 's':
+				stages = 1;
+				break;
+			case 'p':
+				predict = atoi(optarg);
+				break;
+			case 'r':
+				record = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (record)
+	{
+		if (argc - optind < 2)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		return wcm_replay_record(argv[optind], argv[optind + 1],
+					 argc - optind > 2 ? atol(argv[optind + 2]) : 0);
+	}
+
+	if (argc - optind != 1 || iterations < 1 || drop < 0 ||
+	    predict < 0 || predict > MAX_PREDICT)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	events = wcm_replay_load(argv[optind], &nevents);
+	if (!events || !nevents)
+		return 1;
+
+	pInfo = wcm_replay_init(argv[optind]);
+	if (!pInfo)
+		return 1;
+
+	if (stages)
+	{
+		WacomDevicePtr priv = pInfo->private;
+
+		for (priv = priv->common->wcmDevices; priv; priv = priv->next)
+			priv->stageTiming = TRUE;
+	}
+
+	frames = calloc(nevents + 1, sizeof(*frames));
+	if (!frames)
+		return 1;
+	nframes = split_frames(events, nevents, frames);
+
+	samples = calloc((size_t)nframes * iterations, sizeof(*samples));
+	if (!samples)
+		return 1;
+
+	/* one untimed pass to warm up caches and settle driver state */
+	replay.nioctls = 0;
+	for (f = 0, i = 0; f < nframes; i = frames[f++])
+	{
+		wcm_replay_update_state(events + i, frames[f] - i);
+		replay_frame(pInfo, events + i, frames[f] - i);
+	}
+
+	replay.nioctls = 0;
+	for (c = 0; c < iterations; c++)
+	{
+		for (f = 0, i = 0; f < nframes; i = frames[f++])
+		{
+			uint64_t start;
+
+			wcm_replay_update_state(events + i, frames[f] - i);
+
+			start = now_ns();
+			/* the kernel lost this frame, the driver has to
+			 * pick up the state from EVIOCGKEY and friends */
+			if (drop && f % drop == drop - 1)
+				replay_frame(pInfo, &dropped, 1);
+			replay_frame(pInfo, events + i, frames[f] - i);
+			samples[nsamples] = now_ns() - start;
+			total += samples[nsamples++];
+		}
+	}
+
+	qsort(samples, nsamples, sizeof(*samples), cmp_u64);
+
+	printf("capture:     %s (%s, %04x:%04x)\n", argv[optind],
+	       replay.header.name, replay.header.vendor, replay.header.product);
+	printf("events:      %d in %d frames, %d iterations\n",
+	       nevents, nframes, iterations);
+	printf("per event:   %.1f ns, %.0f events/sec\n",
+	       (double)total / ((double)nevents * iterations),
+	       (double)nevents * iterations * 1e9 / (double)total);
+	printf("per frame:   p50 %.2f us, p90 %.2f us, p99 %.2f us, max %.2f us\n",
+	       percentile(samples, nsamples, 50),
+	       percentile(samples, nsamples, 90),
+	       percentile(samples, nsamples, 99),
+	       samples[nsamples - 1] / 1000.0);
+	printf("ioctls:      %.3f per frame\n",
+	       (double)replay.nioctls / nsamples);
+
+	if (stages)
+	{
+		WacomDevicePtr priv = pInfo->private;
+
+		/* the warm-up pass is counted too */
+		for (priv = priv->common->wcmDevices; priv; priv = priv->next)
+		{
+			printf("stages:      %s\n", priv->name);
+			for (i = 0; i < priv->nstages; i++)
+			{
+				const WacomStageStats *stats = &priv->stageStats[priv->stages[i]];
+
+				printf("  %-16s %10llu events, %7.1f ns/event\n",
+				       wcmStageName(priv->stages[i]),
+				       (unsigned long long)stats->events,
+				       stats->events ? (double)stats->ns / stats->events : 0.0);
+			}
+		}
+	}
+
+	if (predict && report_prediction(pInfo, events, frames, nframes, predict))
+		return 1;
+
+	free(samples);
+	free(frames);
+	free(events);
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8 shiftwidth=8: */
@@ -0,0 +1,89 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __WACOM_REPLAY_H
+#define __WACOM_REPLAY_H
+
+#include <stdint.h>
+
+/**
+ * Capture file format used by wacom-bench.
+ *
+ * A capture is a description of an evdev device followed by the events
+ * read from it, in the order they were read:
+ *
+ *   struct wcm_replay_header  header;
+ *   (header.header_size - sizeof(header) bytes reserved for extensions)
+ *   struct wcm_replay_event   events[header.nevents];
+ *
+ * All integers are little-endian and all structs are packed. Bitmaps use
+ * the kernel's layout, i.e. bit N lives in byte N / 8 at position N % 8.
+ *
+ * The header holds everything the driver queries through ioctl() while
+ * initializing a USB device (EVIOCGID, EVIOCGNAME, EVIOCGBIT, EVIOCGABS,
+ * EVIOCGPROP), so a capture goes through the same PreInit code as the
+ * real device would. The absinfo value fields hold the state at the start
+ * of the capture.
+ */
+
+#define WCM_REPLAY_MAGIC	"WCMRPLY1"
+#define WCM_REPLAY_VERSION	1
+
+#define WCM_REPLAY_EV_BYTES	4	/* EV_MAX 0x1f */
+#define WCM_REPLAY_KEY_BYTES	96	/* KEY_MAX 0x2ff */
+#define WCM_REPLAY_ABS_COUNT	64	/* ABS_MAX 0x3f */
+#define WCM_REPLAY_SW_BYTES	4
+#define WCM_REPLAY_PROP_BYTES	4	/* INPUT_PROP_MAX 0x1f */
+
+struct wcm_replay_absinfo {
+	int32_t value;
+	int32_t minimum;
+	int32_t maximum;
+	int32_t fuzz;
+	int32_t flat;
+	int32_t resolution;
+} __attribute__((packed));
+
+struct wcm_replay_header {
+	char     magic[8];		/* WCM_REPLAY_MAGIC, not terminated */
+	uint32_t version;		/* WCM_REPLAY_VERSION */
+	uint32_t header_size;		/* offset of the first event */
+	uint16_t bustype;		/* struct input_id */
+	uint16_t vendor;
+	uint16_t product;
+	uint16_t id_version;
+	char     name[80];		/* EVIOCGNAME, NUL-padded */
+	uint8_t  evbits[WCM_REPLAY_EV_BYTES];
+	uint8_t  keybits[WCM_REPLAY_KEY_BYTES];
+	uint8_t  absbits[WCM_REPLAY_ABS_COUNT / 8];
+	uint8_t  swbits[WCM_REPLAY_SW_BYTES];
+	uint8_t  propbits[WCM_REPLAY_PROP_BYTES];
+	struct wcm_replay_absinfo absinfo[WCM_REPLAY_ABS_COUNT];
+	uint32_t nevents;
+} __attribute__((packed));
+
+/* One struct input_event with a fixed-width timestamp */
+struct wcm_replay_event {
+	uint32_t sec;
+	uint32_t usec;
+	uint16_t type;
+	uint16_t code;
+	int32_t  value;
+} __attribute__((packed));
+
+#endif /* __WACOM_REPLAY_H */
+
+/* vim: set noexpandtab tabstop=8 shiftwidth=8: */
@@ -22,6 +22,16 @@
 
 #include "fake-symbols.h"
 #include <xf86Wacom.h>
+#include <wcmTrace.h>
+#include <wcmFilter.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/input.h>
 
 /**
  * NOTE: this file may not contain tests that require static variables. The
@@ -139,6 +149,42 @@ test_common_ref(void)
 	assert(!second && !common);
 }
 
+/**
+ * Channels grow with the number of contacts and the pad stays last.
+ */
+static void
+test_alloc_channels(void)
+{
+	WacomCommonPtr common;
+
+	common = wcmNewCommon();
+	assert(common);
+	assert(common->wcmChannelCnt == MIN_CONTACTS + 2);
+
+	common->wcmChannel[0].work.serial_num = 1;
+	common->wcmChannel[PAD_CHANNEL(common)].work.device_type = PAD_ID;
+	SETBIT(common->wcmBusyChannels, PAD_CHANNEL(common));
+	SETBIT(common->wcmDirtyChannels, 0);
+
+	assert(wcmAllocChannels(common, 10));
+	assert(common->wcmChannelCnt == 10 + 2);
+	assert(common->wcmChannel[0].work.serial_num == 1);
+	assert(common->wcmChannel[PAD_CHANNEL(common)].work.device_type == PAD_ID);
+	assert(common->wcmChannel[MIN_CONTACTS + 1].work.device_type == 0);
+	assert(ISBITSET(common->wcmBusyChannels, PAD_CHANNEL(common)));
+	assert(!ISBITSET(common->wcmBusyChannels, MIN_CONTACTS + 1));
+	assert(ISBITSET(common->wcmDirtyChannels, 0));
+
+	/* never shrinks */
+	assert(wcmAllocChannels(common, 1));
+	assert(common->wcmChannelCnt == 10 + 2);
+
+	/* capped for absurd contact counts */
+	assert(wcmAllocChannels(common, 1 << 20));
+	assert(common->wcmChannelCnt == MAX_CONTACTS + 2);
+
+	wcmFreeCommon(&common);
+}
 
 static void
 test_rebase_pressure(void)
@@ -300,7 +346,7 @@ test_suppress(void)
 	WacomDeviceState old = {0},
 			 new = {0};
 
-	common.wcmSuppress = 2;
+	wcmSetSuppress(&common, 2);
 
 	rc = wcmCheckSuppress(&common, &old, &new);
 	assert(rc == SUPPRESS_ALL);
@@ -391,6 +437,425 @@ test_suppress(void)
 	new.pressure = old.pressure;
 }
 
+/**
+ * The running sums average the same as summing the whole window, also
+ * after the window size changed.
+ */
+static void
+test_filter_coord(void)
+{
+	WacomCommonPtr common;
+	WacomChannel channel = {0};
+	WacomDeviceState ds = {0};
+	int raw[MAX_SAMPLES * 3];
+	int i, j, window;
+
+	common = wcmNewCommon();
+	assert(common);
+
+	for (i = 0; i < ARRAY_SIZE(raw); i++)
+		raw[i] = (i * 7919) % 1000 - 300;
+
+	for (window = 1; window <= MAX_SAMPLES; window++)
+	{
+		common->wcmRawSample = window;
+		wcmResetSampleCounter(&channel);
+
+		for (i = 0; i < ARRAY_SIZE(raw); i++)
+		{
+			int sum = 0;
+
+			ds.x = raw[i];
+			ds.y = -raw[i];
+			wcmFilterCoord(common, &channel, &ds);
+
+			/* the window starts out filled with the first sample */
+			for (j = 0; j < window; j++)
+				sum += raw[(i - j < 0) ? 0 : i - j];
+			assert(ds.x == sum / window);
+			assert(ds.y == -sum / window);
+		}
+	}
+
+	/* resizing the window starts over with the current sample */
+	common->wcmRawSample = 2;
+	ds.x = 100;
+	wcmFilterCoord(common, &channel, &ds);
+	assert(ds.x == 100);
+	ds.x = 200;
+	wcmFilterCoord(common, &channel, &ds);
+	assert(ds.x == 150);
+
+	/* the average keeps its window across a gap in the reports */
+	ds.time_us += 2 * FILTER_MAX_INTERVAL;
+	ds.x = 300;
+	wcmFilterCoord(common, &channel, &ds);
+	assert(ds.x == 250);
+
+	wcmFreeCommon(&common);
+}
+
+/**
+ * Runs a synthetic stroke through the coordinate filter, at one sample
+ * per FILTER_INTERVAL.
+ *
+ * @param speed Pen speed in units per sample
+ * @param noise Amplitude of the jitter added to the pen position
+ * @param[out] lag Average distance behind the pen, in samples
+ * @param[out] jitter Variance of the distance behind the pen
+ */
+static void
+filter_stroke(WacomCommonPtr common, int speed, int noise,
+	      double *lag, double *jitter)
+{
+	WacomChannel channel = {0};
+	WacomDeviceState ds = {0};
+	unsigned int seed = 1;
+	double sum = 0, sum2 = 0;
+	int i, n = 0;
+
+	ds.device_type = STYLUS_ID;
+	wcmResetSampleCounter(&channel);
+
+	for (i = 0; i < 2000; i++)
+	{
+		int pos = 10000 + i * speed;
+		double d;
+
+		seed = seed * 1103515245 + 12345;
+		ds.x = pos + (int)((seed >> 16) % (2 * noise + 1)) - noise;
+		ds.y = pos;
+		ds.time_us = 1000000 + (uint64_t)i * FILTER_INTERVAL;
+		wcmFilterCoord(common, &channel, &ds);
+
+		/* give the filters time to settle */
+		if (i < 500)
+			continue;
+
+		d = pos - ds.x;
+		sum += d;
+		sum2 += d * d;
+		n++;
+	}
+
+	*lag = speed ? sum / n / speed : 0;
+	*jitter = sum2 / n - (sum / n) * (sum / n);
+}
+
+/**
+ * The One-Euro and Kalman filters lag less than the sliding average on a
+ * stroke and jitter about as much on a resting pen.
+ */
+static void
+test_filter_modes(void)
+{
+	WacomCommonPtr common;
+	double lag[FILTER_MODE_COUNT], jitter[FILTER_MODE_COUNT];
+	double unused;
+	int mode;
+
+	common = wcmNewCommon();
+	assert(common);
+	common->wcmResolX = common->wcmResolY = 100000;
+	common->wcmRawSample = DEFAULT_SAMPLES;
+
+	for (mode = 0; mode < FILTER_MODE_COUNT; mode++)
+	{
+		common->wcmFilterMode = mode;
+		filter_stroke(common, 0, 8, &unused, &jitter[mode]);
+		filter_stroke(common, 20, 0, &lag[mode], &unused);
+	}
+
+	/* the average lags (RawSample - 1) / 2 samples */
+	assert(lag[FILTER_MODE_AVERAGE] > (DEFAULT_SAMPLES - 1) / 2.0 - 0.1);
+	assert(lag[FILTER_MODE_AVERAGE] < (DEFAULT_SAMPLES - 1) / 2.0 + 0.1);
+
+	for (mode = FILTER_MODE_AVERAGE + 1; mode < FILTER_MODE_COUNT; mode++)
+	{
+		assert(lag[mode] < lag[FILTER_MODE_AVERAGE] / 2);
+		assert(jitter[mode] < jitter[FILTER_MODE_AVERAGE] * 1.2);
+	}
+
+	wcmFreeCommon(&common);
+}
+
+static void
+push_pen_state(WacomChannelPtr channel, int x, int y, int ms)
+{
+	WacomDeviceState *ds;
+
+	channel->valid.head = (channel->valid.head + 1) % MAX_SAMPLES;
+	ds = wcmChannelState(channel, 0);
+	memset(ds, 0, sizeof(*ds));
+	ds->device_type = STYLUS_ID;
+	ds->serial_num = 1;
+	ds->proximity = 1;
+	ds->x = x;
+	ds->y = y;
+	ds->time_us = 1000000 + (uint64_t)ms * 1000;
+}
+
+/**
+ * The prediction extrapolates velocity and acceleration, but not across
+ * proximity and button changes, turns and gaps in the reports. Short of a
+ * proximity change the lead fades out there.
+ */
+static void
+test_predict(void)
+{
+	WacomCommonRec common = {0};
+	WacomChannel channel = {0};
+	WacomDeviceState ds;
+	int lead, ms;
+
+	common.wcmMaxX = common.wcmMaxY = 10000;
+
+	/* 10 units/ms along x, 5 along y */
+	push_pen_state(&channel, 1000, 2000, 0);
+	push_pen_state(&channel, 1050, 2025, 5);
+	push_pen_state(&channel, 1100, 2050, 10);
+	ds = *wcmChannelState(&channel, 0);
+	assert(!wcmPredictCoord(&common, &channel, &ds, 0));
+	assert(wcmPredictCoord(&common, &channel, &ds, 10000));
+	assert(ds.x == 1200);
+	assert(ds.y == 2100);
+
+	/* speeding up from 2 to 4 units/ms */
+	push_pen_state(&channel, 1110, 2050, 15);
+	push_pen_state(&channel, 1130, 2050, 20);
+	ds = *wcmChannelState(&channel, 0);
+	assert(wcmPredictCoord(&common, &channel, &ds, 10000));
+	assert(ds.x == 1130 + 40 + 20);
+
+	/* never past the edge of the tablet */
+	push_pen_state(&channel, 9900, 2050, 25);
+	push_pen_state(&channel, 9950, 2050, 30);
+	push_pen_state(&channel, 10000, 2050, 35);
+	ds = *wcmChannelState(&channel, 0);
+	assert(wcmPredictCoord(&common, &channel, &ds, 10000));
+	assert(ds.x == 10000);
+
+	/* turning around */
+	push_pen_state(&channel, 1000, 2000, 40);
+	push_pen_state(&channel, 1050, 2000, 45);
+	push_pen_state(&channel, 1020, 2000, 50);
+	ds = *wcmChannelState(&channel, 0);
+	assert(!wcmPredictCoord(&common, &channel, &ds, 10000));
+
+	/* at rest */
+	push_pen_state(&channel, 1020, 2000, 55);
+	push_pen_state(&channel, 1020, 2000, 60);
+	ds = *wcmChannelState(&channel, 0);
+	assert(!wcmPredictCoord(&common, &channel, &ds, 10000));
+
+	/* a button went down, the lead fades out over the next reports */
+	push_pen_state(&channel, 1030, 2000, 65);
+	push_pen_state(&channel, 1040, 2000, 70);
+	ds = *wcmChannelState(&channel, 0);
+	assert(wcmPredictCoord(&common, &channel, &ds, 10000));
+	assert(ds.x == 1060);
+	wcmChannelState(&channel, 0)->buttons = 1;
+	ds = *wcmChannelState(&channel, 0);
+	assert(wcmPredictCoord(&common, &channel, &ds, 10000));
+	assert(ds.x == 1050);
+	for (lead = 5, ms = 70; lead > 0; lead /= 2)
+	{
+		push_pen_state(&channel, 1040, 2000, ms += 1);
+		ds = *wcmChannelState(&channel, 0);
+		assert(wcmPredictCoord(&common, &channel, &ds, 10000));
+		assert(ds.x == 1040 + lead);
+	}
+	push_pen_state(&channel, 1040, 2000, ms += 1);
+	ds = *wcmChannelState(&channel, 0);
+	assert(!wcmPredictCoord(&common, &channel, &ds, 10000));
+
+	/* just came into proximity */
+	push_pen_state(&channel, 1050, 2000, 75);
+	wcmChannelState(&channel, 2)->proximity = 0;
+	ds = *wcmChannelState(&channel, 0);
+	assert(!wcmPredictCoord(&common, &channel, &ds, 10000));
+
+	/* after a gap in the reports */
+	push_pen_state(&channel, 1060, 2000, 80);
+	push_pen_state(&channel, 1070, 2000, 85);
+	push_pen_state(&channel, 1080, 2000, 200);
+	ds = *wcmChannelState(&channel, 0);
+	assert(!wcmPredictCoord(&common, &channel, &ds, 10000));
+}
+
+/**
+ * Suppress thresholds follow the resolution and range of each axis.
+ */
+static void
+test_suppress_axes(void)
+{
+	enum WacomSuppressMode rc;
+	WacomCommonRec common = {0};
+	WacomDeviceState old = {0},
+			 new = {0};
+
+	common.wcmResolX = common.wcmResolY = 200000;
+	common.wcmTouchResolX = common.wcmTouchResolY = 10000;
+	common.wcmMaxZ = 8191;
+	common.wcmTiltMinX = -64;
+	common.wcmTiltMaxX = 63;
+	wcmSetSuppress(&common, 2);
+
+	assert(common.wcmSuppress == 2);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_X] == 4);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_Y] == 4);
+	/* rounds to 0 but is still clamped to 1 */
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_TOUCH_X] == 1);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_TOUCH_Y] == 1);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_PRESSURE] == 8);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_TILT] == 2);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_ROTATION] == 2);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_WHEEL] == 2);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_THROTTLE] == 2);
+
+	old.proximity = new.proximity = 1;
+
+	/* pen motion below the pen threshold is dropped */
+	new.x = 4;
+	rc = wcmCheckSuppress(&common, &old, &new);
+	assert(rc == SUPPRESS_ALL);
+	assert(new.x == old.x);
+
+	new.pressure = 9;
+	rc = wcmCheckSuppress(&common, &old, &new);
+	assert(rc == SUPPRESS_NONE);
+	new.pressure = old.pressure;
+
+	/* the touch threshold follows the low resolution of the sensor */
+	old.device_type = new.device_type = TOUCH_ID;
+	new.x = 1;
+	rc = wcmCheckSuppress(&common, &old, &new);
+	assert(rc == SUPPRESS_ALL);
+	new.x = 2;
+	rc = wcmCheckSuppress(&common, &old, &new);
+	assert(rc == SUPPRESS_NON_MOTION);
+
+	wcmSetSuppress(&common, 0);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_X] == 0);
+	assert(common.wcmSuppressAxis[SUPPRESS_AXIS_PRESSURE] == 0);
+}
+
+/**
+ * Tools are found by type and serial, with the serial 0 tool of a type as
+ * fallback.
+ */
+static void
+test_find_tool(void)
+{
+	WacomCommonRec common = {0};
+	WacomTool tools[4] = {
+		{ .typeid = STYLUS_ID, .serial = 0 },
+		{ .typeid = STYLUS_ID, .serial = 0x1234 },
+		{ .typeid = ERASER_ID, .serial = 0x1234 },
+		{ .typeid = STYLUS_ID, .serial = 0x1234 + TOOL_HASH_SIZE },
+	};
+	WacomDeviceState ds = {0};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tools) - 1; i++)
+		tools[i].next = &tools[i + 1];
+	common.wcmTool = &tools[0];
+	wcmRebuildToolIndex(&common);
+
+	ds.device_type = STYLUS_ID;
+	ds.serial_num = 0x1234;
+	assert(findTool(&common, &ds) == &tools[1]);
+	/* served from the last tool cache */
+	assert(findTool(&common, &ds) == &tools[1]);
+
+	ds.serial_num = 0x1234 + TOOL_HASH_SIZE;
+	assert(findTool(&common, &ds) == &tools[3]);
+
+	ds.serial_num = 0x4321;
+	assert(findTool(&common, &ds) == &tools[0]);
+	ds.serial_num = 0;
+	assert(findTool(&common, &ds) == &tools[0]);
+
+	ds.device_type = ERASER_ID;
+	ds.serial_num = 0x1234;
+	assert(findTool(&common, &ds) == &tools[2]);
+	ds.serial_num = 0x4321;
+	assert(findTool(&common, &ds) == NULL);
+
+	ds.device_type = CURSOR_ID;
+	assert(findTool(&common, &ds) == NULL);
+
+	/* removing a tool drops it from the index and the cache */
+	ds.device_type = STYLUS_ID;
+	ds.serial_num = 0x1234;
+	assert(findTool(&common, &ds) == &tools[1]);
+	tools[0].next = &tools[2];
+	wcmRebuildToolIndex(&common);
+	assert(findTool(&common, &ds) == &tools[0]);
+}
+
+static Bool
+has_stage(const WacomDeviceRec *priv, enum WacomStage stage)
+{
+	int i;
+
+	for (i = 0; i < priv->nstages; i++)
+		if (priv->stages[i] == stage)
+			return TRUE;
+	return FALSE;
+}
+
+/**
+ * Devices only run the pipeline stages that apply to their type, in
+ * pipeline order.
+ */
+static void
+test_init_stages(void)
+{
+	WacomCommonRec common = {0};
+	WacomDeviceRec priv = {0};
+	int i;
+
+	priv.common = &common;
+	common.wcmMaxZ = 2047;
+
+	priv.flags = STYLUS_ID;
+	wcmInitStages(&priv);
+	assert(has_stage(&priv, STAGE_FILTER));
+	assert(has_stage(&priv, STAGE_ARBITRATE));
+	assert(has_stage(&priv, STAGE_PRESSURE_BUTTON));
+	assert(!has_stage(&priv, STAGE_GESTURE));
+	assert(!has_stage(&priv, STAGE_PROXOUT));
+	assert(has_stage(&priv, STAGE_PREDICT));
+	assert(priv.stages[priv.nstages - 1] == STAGE_SEND);
+	for (i = 1; i < priv.nstages; i++)
+		assert(priv.stages[i - 1] < priv.stages[i]);
+
+	priv.flags = TOUCH_ID;
+	wcmInitStages(&priv);
+	assert(has_stage(&priv, STAGE_GESTURE));
+	assert(has_stage(&priv, STAGE_PRESSURE));
+	assert(!has_stage(&priv, STAGE_PRESSURE_BUTTON));
+	assert(!has_stage(&priv, STAGE_PREDICT));
+
+	priv.flags = PAD_ID;
+	wcmInitStages(&priv);
+	assert(!has_stage(&priv, STAGE_FILTER));
+	assert(!has_stage(&priv, STAGE_ARBITRATE));
+	assert(!has_stage(&priv, STAGE_PRESSURE));
+	assert(!has_stage(&priv, STAGE_RELATIVE));
+	assert(has_stage(&priv, STAGE_SUPPRESS));
+
+	priv.flags = CURSOR_ID;
+	wcmInitStages(&priv);
+	assert(!has_stage(&priv, STAGE_TILT2ROTATION));
+	assert(has_stage(&priv, STAGE_CURSOR_PROX));
+	assert(has_stage(&priv, STAGE_PROXOUT));
+	TabletSetFeature(&common, WCM_ROTATION | WCM_RING);
+	wcmInitStages(&priv);
+	assert(has_stage(&priv, STAGE_TILT2ROTATION));
+}
+
 static void
 test_tilt_to_rotation(void)
 {
@@ -519,6 +984,56 @@ test_mod_buttons(void)
 	assert(mod_buttons(0, sizeof(int) * 8, 1) == 0);
 }
 
+static void
+test_event_queue_size(void)
+{
+	unsigned long abs[NBITS(ABS_MAX)] = {0};
+
+	SETBIT(abs, ABS_X);
+	SETBIT(abs, ABS_Y);
+	SETBIT(abs, ABS_PRESSURE);
+	assert(usbEventQueueSize(abs, 0) == 32 + 3);
+
+	/* 10 fingers with slot, tracking id, x, y and pressure each */
+	SETBIT(abs, ABS_MT_SLOT);
+	SETBIT(abs, ABS_MT_TRACKING_ID);
+	SETBIT(abs, ABS_MT_POSITION_X);
+	SETBIT(abs, ABS_MT_POSITION_Y);
+	SETBIT(abs, ABS_MT_PRESSURE);
+	assert(usbEventQueueSize(abs, 10) == 32 + 3 + 10 * 5);
+
+	/* capped for absurd slot counts */
+	assert(usbEventQueueSize(abs, 1 << 20) == 4096);
+}
+
+static void
+test_channel_bits(void)
+{
+	unsigned long mask[NBITS(3 * BITS_PER_LONG)] = {0};
+	int nbits = 2 * BITS_PER_LONG + 5;
+	int i;
+
+	assert(usbNextBit(mask, nbits, 0) == nbits);
+	assert(usbFirstClearBit(mask, nbits) == 0);
+
+	SETBIT(mask, 0);
+	SETBIT(mask, BITS_PER_LONG + 1);
+	assert(usbNextBit(mask, nbits, 0) == 0);
+	assert(usbNextBit(mask, nbits, 1) == BITS_PER_LONG + 1);
+	assert(usbNextBit(mask, nbits, BITS_PER_LONG + 2) == nbits);
+	assert(usbNextBit(mask, nbits, nbits) == nbits);
+	assert(usbFirstClearBit(mask, nbits) == 1);
+
+	/* bits past nbits don't count */
+	for (i = 0; i < nbits; i++)
+		SETBIT(mask, i);
+	assert(usbFirstClearBit(mask, nbits) == nbits);
+	CLEARBIT(mask, nbits - 1);
+	assert(usbFirstClearBit(mask, nbits) == nbits - 1);
+	SETBIT(mask, nbits + 1);
+	assert(usbNextBit(mask, nbits, nbits - 1) == nbits);
+}
+
 static void test_set_type(void)
 {
 	InputInfoRec info = {0};
@@ -598,6 +1113,769 @@ static void test_set_type(void)
 #undef reset
 }
 
+#define TEST_PACKET_SIZE 7
+
+/* The stream is filled with its own offset, so every byte handed to the
+ * parser can be checked against the ring's read index. */
+static int test_parse_packet(InputInfoPtr pInfo, const unsigned char* data, int len)
+{
+	WacomDevicePtr priv = pInfo->private;
+	WacomCommonPtr common = priv->common;
+	unsigned int avail = common->head - common->tail;
+	int i;
+
+	assert(len > 0);
+	assert((unsigned int)len <= avail);
+	assert((unsigned int)len >= min(avail, MAX_PACKET_SIZE));
+
+	for (i = 0; i < len; i++)
+		assert(data[i] == (unsigned char)(common->tail + i));
+
+	return (len < TEST_PACKET_SIZE) ? 0 : TEST_PACKET_SIZE;
+}
+
+static void test_parse_buffer(void)
+{
+	InputInfoRec info = {0};
+	WacomDeviceRec priv = {0};
+	WacomCommonRec common = {0};
+	WacomModel model = {0};
+	unsigned int offset, start, chunk;
+
+	info.private = &priv;
+	priv.common = &common;
+	common.wcmModel = &model;
+	model.Parse = test_parse_packet;
+
+	/* start close to the end so the packets straddle the wrap */
+	start = RING_SIZE - 10;
+	common.head = common.tail = start;
+
+	for (offset = start, chunk = 1; offset < start + 3 * RING_SIZE; chunk = chunk % 29 + 1)
+	{
+		unsigned int i;
+
+		for (i = 0; i < chunk; i++, offset++)
+			common.buffer[offset & RING_MASK] = offset;
+		common.head = offset;
+
+		wcmParseBuffer(&info);
+
+		assert((common.tail - start) % TEST_PACKET_SIZE == 0);
+		assert(common.head - common.tail < TEST_PACKET_SIZE);
+	}
+}
+
+/* Only consumes data once it can see all of it, like a frame parser
+ * waiting for the end of the frame. */
+static int test_parse_frame(InputInfoPtr pInfo, const unsigned char* data, int len)
+{
+	WacomDevicePtr priv = pInfo->private;
+	WacomCommonPtr common = priv->common;
+	int i;
+
+	for (i = 0; i < len; i++)
+		assert(data[i] == (unsigned char)(common->tail + i));
+
+	return ((unsigned int)len < common->head - common->tail) ? 0 : len;
+}
+
+static void test_parse_buffer_frame(void)
+{
+	InputInfoRec info = {0};
+	WacomDeviceRec priv = {0};
+	WacomCommonRec common = {0};
+	WacomModel model = {0};
+	unsigned int offset;
+
+	info.private = &priv;
+	priv.common = &common;
+	common.wcmModel = &model;
+	model.Parse = test_parse_frame;
+
+	/* a frame much larger than the mirrored area, spanning the wrap */
+	common.head = common.tail = RING_SIZE - 100;
+	for (offset = common.head; offset < RING_SIZE + 500; offset++)
+		common.buffer[offset & RING_MASK] = offset;
+	common.head = offset;
+
+	wcmParseBuffer(&info);
+	assert(common.tail == common.head);
+}
+
+/* Consumes one input_event at a time; each event carries its own stream
+ * offset as value. */
+static int test_parse_event(InputInfoPtr pInfo, const unsigned char* data, int len)
+{
+	WacomDevicePtr priv = pInfo->private;
+	WacomCommonPtr common = priv->common;
+	struct input_event ev;
+
+	if (len < (int)sizeof(ev))
+		return 0;
+
+	memcpy(&ev, data, sizeof(ev));
+	assert(ev.type == EV_MSC);
+	assert((unsigned int)ev.value == common->tail);
+
+	return sizeof(ev);
+}
+
+static void test_read_packet(void)
+{
+	InputInfoRec info = {0};
+	WacomDeviceRec priv = {0};
+	WacomCommonRec common = {0};
+	WacomModel model = {0};
+	struct input_event ev = {0};
+	unsigned int offset, end;
+	int fds[2];
+	int i, rc;
+
+	info.private = &priv;
+	info.name = "test";
+	priv.common = &common;
+	common.wcmModel = &model;
+	model.Parse = test_parse_event;
+
+	rc = pipe(fds);
+	assert(rc == 0);
+	rc = fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	assert(rc == 0);
+	info.fd = fds[0];
+
+	/* less than one event left before the ring end */
+	common.head = common.tail = RING_SIZE - 16;
+	offset = common.head;
+
+	/* the byte count carries into its high word */
+	common.wcmStats[STAT_BYTES_READ] = UINT32_MAX - 100;
+	end = offset + 3 * RING_SIZE;
+
+	ev.type = EV_MSC;
+	while (offset < end)
+	{
+		for (i = 0; i < 100 && offset < end; i++, offset += sizeof(ev))
+		{
+			ev.value = offset;
+			rc = write(fds[1], &ev, sizeof(ev));
+			assert(rc == sizeof(ev));
+		}
+
+		while ((rc = wcmReadPacket(&info)) > 0)
+			assert(rc % sizeof(ev) == 0);
+		assert(rc == 0);
+		assert(common.tail == offset);
+	}
+
+	assert(common.wcmStats[STAT_BYTES_READ_HIGH] == 1);
+	assert(common.wcmStats[STAT_BYTES_READ] == offset - (RING_SIZE - 16) - 101);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+#define TEST_SLOTS 2
+
+/* A fake evdev device for the USB tests. The driver reads its events from
+ * a pipe, its ioctls on that pipe are answered from here. */
+struct test_evdev {
+	int fd[2];
+	struct input_id id;
+	unsigned long keybits[NBITS(KEY_MAX)];
+	unsigned long absbits[NBITS(ABS_MAX)];
+	unsigned long keys[NBITS(KEY_MAX)];	/* EVIOCGKEY */
+	struct input_absinfo abs[ABS_CNT];	/* EVIOCGABS */
+	int32_t mt[ABS_CNT - ABS_MT_SLOT][TEST_SLOTS]; /* EVIOCGMTSLOTS */
+} test_evdev = { .fd = { -1, -1 } };
+
+static int test_evdev_bits(void *arg, unsigned int size, const void *bits, size_t len)
+{
+	memset(arg, 0, size);
+	len = min(size, len);
+	if (len)
+		memcpy(arg, bits, len);
+	return len;
+}
+
+/* Overrides the libc ioctl() for the driver code too */
+int ioctl(int fd, unsigned long request, ...)
+{
+	unsigned int nr = _IOC_NR(request);
+	unsigned int size = _IOC_SIZE(request);
+	unsigned long evbits = (1 << EV_SYN) | (1 << EV_KEY) | (1 << EV_ABS) | (1 << EV_MSC);
+	va_list args;
+	void *arg;
+
+	va_start(args, request);
+	arg = va_arg(args, void*);
+	va_end(args);
+
+	if (fd < 0 || fd != test_evdev.fd[0])
+		return syscall(SYS_ioctl, fd, request, arg);
+
+	if (request == EVIOCGID)
+	{
+		*(struct input_id*)arg = test_evdev.id;
+		return 0;
+	}
+
+	if (_IOC_TYPE(request) != 'E' || _IOC_DIR(request) != _IOC_READ)
+		goto invalid;
+
+	if (nr >= _IOC_NR(EVIOCGABS(0)) && nr < _IOC_NR(EVIOCGABS(ABS_CNT)))
+	{
+		int code = nr - _IOC_NR(EVIOCGABS(0));
+
+		if (!ISBITSET(test_evdev.absbits, code))
+			goto invalid;
+		*(struct input_absinfo*)arg = test_evdev.abs[code];
+		return 0;
+	}
+
+	if (nr == _IOC_NR(EVIOCGBIT(0, 0)))
+		return test_evdev_bits(arg, size, &evbits, sizeof(evbits));
+	else if (nr == _IOC_NR(EVIOCGBIT(EV_KEY, 0)))
+		return test_evdev_bits(arg, size, test_evdev.keybits, sizeof(test_evdev.keybits));
+	else if (nr == _IOC_NR(EVIOCGBIT(EV_ABS, 0)))
+		return test_evdev_bits(arg, size, test_evdev.absbits, sizeof(test_evdev.absbits));
+	else if (nr > _IOC_NR(EVIOCGBIT(0, 0)) && nr < _IOC_NR(EVIOCGBIT(EV_CNT, 0)))
+		return test_evdev_bits(arg, size, NULL, 0);
+	else if (nr == _IOC_NR(EVIOCGNAME(0)))
+		return test_evdev_bits(arg, size, "Wacom Test", sizeof("Wacom Test"));
+	else if (nr == _IOC_NR(EVIOCGKEY(0)))
+		return test_evdev_bits(arg, size, test_evdev.keys, sizeof(test_evdev.keys));
+	else if (nr == _IOC_NR(EVIOCGSW(0)) || nr == _IOC_NR(EVIOCGPROP(0)))
+		return test_evdev_bits(arg, size, NULL, 0);
+	else if (nr == _IOC_NR(EVIOCGMTSLOTS(0)))
+	{
+		int32_t *values = arg;
+		int code = values[0];
+		int i;
+
+		if (code <= ABS_MT_SLOT || code >= ABS_CNT ||
+		    !ISBITSET(test_evdev.absbits, code))
+			goto invalid;
+
+		for (i = 0; i < TEST_SLOTS && i < size / sizeof(int32_t) - 1; i++)
+			values[1 + i] = test_evdev.mt[code - ABS_MT_SLOT][i];
+		return 0;
+	}
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+static void test_evdev_init(int product)
+{
+	int rc, i;
+
+	memset(&test_evdev, 0, sizeof(test_evdev));
+	rc = pipe(test_evdev.fd);
+	assert(rc == 0);
+	rc = fcntl(test_evdev.fd[0], F_SETFL, O_NONBLOCK);
+	assert(rc == 0);
+
+	test_evdev.id.bustype = BUS_USB;
+	test_evdev.id.vendor = WACOM_VENDOR_ID;
+	test_evdev.id.product = product;
+
+	for (i = 0; i < TEST_SLOTS; i++)
+		test_evdev.mt[ABS_MT_TRACKING_ID - ABS_MT_SLOT][i] = -1;
+}
+
+static void test_evdev_abs(int code, int maximum)
+{
+	SETBIT(test_evdev.absbits, code);
+	test_evdev.abs[code].maximum = maximum;
+}
+
+/* Update the device state, as the kernel does for every event it sends */
+static void test_evdev_update(int type, int code, int value)
+{
+	int slot = test_evdev.abs[ABS_MT_SLOT].value;
+
+	if (type == EV_KEY && value)
+		SETBIT(test_evdev.keys, code);
+	else if (type == EV_KEY)
+		CLEARBIT(test_evdev.keys, code);
+	else if (type == EV_ABS && code > ABS_MT_SLOT)
+		test_evdev.mt[code - ABS_MT_SLOT][slot] = value;
+	else if (type == EV_ABS)
+		test_evdev.abs[code].value = value;
+}
+
+static void test_evdev_send(int type, int code, int value)
+{
+	struct input_event ev = { .type = type, .code = code, .value = value };
+	int rc;
+
+	test_evdev_update(type, code, value);
+	rc = write(test_evdev.fd[1], &ev, sizeof(ev));
+	assert(rc == sizeof(ev));
+}
+
+static void test_evdev_close(void)
+{
+	close(test_evdev.fd[0]);
+	close(test_evdev.fd[1]);
+	test_evdev.fd[0] = test_evdev.fd[1] = -1;
+}
+
+/* Set up a tool on the fake device the way wcmPreInit does */
+static InputInfoPtr test_usb_tool(const char *type)
+{
+	InputInfoPtr pInfo = calloc(1, sizeof(*pInfo));
+	DeviceIntPtr dev = calloc(1, sizeof(*dev));
+	WacomDevicePtr priv;
+	WacomCommonPtr common;
+	char id[BUFFER_SIZE];
+	float version;
+	int rc;
+
+	assert(pInfo && dev);
+	dev->valuator = calloc(1, sizeof(*dev->valuator));
+	assert(dev->valuator);
+	dev->valuator->axes = calloc(MAX_VALUATORS, sizeof(AxisInfo));
+	assert(dev->valuator->axes);
+	dev->public.devicePrivate = pInfo;
+
+	pInfo->name = strdup(type);
+	pInfo->fd = test_evdev.fd[0];
+
+	rc = wcmAllocate(pInfo);
+	assert(rc);
+	pInfo->dev = dev;
+	priv = pInfo->private;
+	priv->name = pInfo->name;
+	common = priv->common;
+	common->device_path = strdup("/dev/input/event-test");
+	common->wcmDevCls = &gWacomUSBDevice;
+	wcmDeviceTypeKeys(pInfo);
+
+	rc = wcmSetType(pInfo, type);
+	assert(rc);
+	rc = common->wcmDevCls->Init(pInfo, id, ARRAY_SIZE(id), &version);
+	assert(rc == Success);
+	rc = wcmInitTablet(pInfo, id, version);
+	assert(rc == Success);
+	wcmInitStages(priv);
+	common->wcmModel->DetectConfig(pInfo);
+	dev->valuator->numAxes = priv->naxes;
+
+	return pInfo;
+}
+
+static void test_usb_read(InputInfoPtr pInfo)
+{
+	int rc;
+
+	while ((rc = wcmReadPacket(pInfo)) > 0)
+		;
+	assert(rc == 0);
+}
+
+static Bool test_touch_in_prox(WacomCommonPtr common, unsigned int serial)
+{
+	int c;
+
+	for (c = 0; c < common->wcmChannelCnt; c++)
+	{
+		const WacomDeviceState *ds = &common->wcmChannel[c].work;
+
+		if (ds->device_type == TOUCH_ID && ds->serial_num == serial &&
+		    ds->proximity)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * After a SYN_DROPPED the state is rebuilt from the kernel's: a button
+ * release or a lifted contact that got lost is picked up, what is still
+ * held stays.
+ */
+static void test_resync(void)
+{
+	InputInfoPtr pInfo;
+	WacomCommonPtr common;
+	WacomDeviceState *pad;
+
+	/* A Graphire4 style pad, it has no pad keys and uses the mouse
+	 * buttons instead */
+	test_evdev_init(0x15);
+	SETBIT(test_evdev.keybits, BTN_TOOL_PEN);
+	SETBIT(test_evdev.keybits, BTN_TOOL_RUBBER);
+	SETBIT(test_evdev.keybits, BTN_TOOL_MOUSE);
+	SETBIT(test_evdev.keybits, BTN_TOOL_FINGER);
+	SETBIT(test_evdev.keybits, BTN_TOUCH);
+	SETBIT(test_evdev.keybits, BTN_STYLUS);
+	SETBIT(test_evdev.keybits, BTN_LEFT);
+	SETBIT(test_evdev.keybits, BTN_RIGHT);
+	SETBIT(test_evdev.keybits, BTN_MIDDLE);
+	test_evdev_abs(ABS_X, 10208);
+	test_evdev_abs(ABS_Y, 7424);
+	test_evdev_abs(ABS_PRESSURE, 511);
+	test_evdev_abs(ABS_DISTANCE, 63);
+	test_evdev_abs(ABS_WHEEL, 71);
+	test_evdev_abs(ABS_MISC, 0xff);
+
+	pInfo = test_usb_tool("pad");
+	common = ((WacomDevicePtr)pInfo->private)->common;
+	pad = &common->wcmChannel[PAD_CHANNEL(common)].work;
+
+	test_evdev_send(EV_KEY, BTN_TOOL_FINGER, 1);
+	test_evdev_send(EV_ABS, ABS_MISC, PAD_DEVICE_ID);
+	test_evdev_send(EV_KEY, BTN_LEFT, 1);
+	test_evdev_send(EV_KEY, BTN_RIGHT, 1);
+	test_evdev_send(EV_MSC, MSC_SERIAL, 0xf0);
+	test_evdev_send(EV_SYN, SYN_REPORT, 0);
+	test_usb_read(pInfo);
+	assert(pad->proximity);
+	assert(pad->buttons == 0x5);
+
+	/* the right button release gets lost */
+	test_evdev_update(EV_KEY, BTN_RIGHT, 0);
+	test_evdev_send(EV_SYN, SYN_DROPPED, 0);
+	test_evdev_send(EV_SYN, SYN_REPORT, 0);
+	test_usb_read(pInfo);
+	assert(pad->proximity);
+	assert(pad->buttons == 0x1);
+
+	test_evdev_close();
+
+	/* A multitouch sensor, one of two contacts is lifted meanwhile */
+	test_evdev_init(0x27);
+	SETBIT(test_evdev.keybits, BTN_TOOL_FINGER);
+	SETBIT(test_evdev.keybits, BTN_TOOL_DOUBLETAP);
+	SETBIT(test_evdev.keybits, BTN_TOUCH);
+	test_evdev_abs(ABS_X, 4096);
+	test_evdev_abs(ABS_Y, 4096);
+	test_evdev_abs(ABS_MT_SLOT, TEST_SLOTS - 1);
+	test_evdev_abs(ABS_MT_TRACKING_ID, 0xffff);
+	test_evdev_abs(ABS_MT_POSITION_X, 4096);
+	test_evdev_abs(ABS_MT_POSITION_Y, 4096);
+
+	pInfo = test_usb_tool("touch");
+	common = ((WacomDevicePtr)pInfo->private)->common;
+
+	test_evdev_send(EV_ABS, ABS_MT_SLOT, 0);
+	test_evdev_send(EV_ABS, ABS_MT_TRACKING_ID, 10);
+	test_evdev_send(EV_ABS, ABS_MT_POSITION_X, 100);
+	test_evdev_send(EV_ABS, ABS_MT_POSITION_Y, 100);
+	test_evdev_send(EV_ABS, ABS_MT_SLOT, 1);
+	test_evdev_send(EV_ABS, ABS_MT_TRACKING_ID, 11);
+	test_evdev_send(EV_ABS, ABS_MT_POSITION_X, 200);
+	test_evdev_send(EV_ABS, ABS_MT_POSITION_Y, 200);
+	test_evdev_send(EV_KEY, BTN_TOUCH, 1);
+	test_evdev_send(EV_KEY, BTN_TOOL_DOUBLETAP, 1);
+	test_evdev_send(EV_SYN, SYN_REPORT, 0);
+	test_usb_read(pInfo);
+	assert(test_touch_in_prox(common, 1));
+	assert(test_touch_in_prox(common, 2));
+
+	test_evdev_update(EV_ABS, ABS_MT_TRACKING_ID, -1);
+	test_evdev_update(EV_KEY, BTN_TOOL_DOUBLETAP, 0);
+	test_evdev_update(EV_KEY, BTN_TOOL_FINGER, 1);
+	test_evdev_send(EV_SYN, SYN_DROPPED, 0);
+	test_evdev_send(EV_SYN, SYN_REPORT, 0);
+	test_usb_read(pInfo);
+	assert(test_touch_in_prox(common, 1));
+	assert(!test_touch_in_prox(common, 2));
+
+	test_evdev_close();
+}
+
+/**
+ * The channel history is a ring, age N is the state wcmEvent accepted N
+ * events ago and ages past the ring give the oldest state.
+ */
+static void test_channel_history(void)
+{
+	InputInfoPtr pInfo;
+	WacomDevicePtr priv;
+	WacomCommonPtr common;
+	WacomChannelPtr channel;
+	WacomDeviceState ds = {0};
+	int i;
+
+	test_evdev_init(0x15);
+	SETBIT(test_evdev.keybits, BTN_TOOL_PEN);
+	SETBIT(test_evdev.keybits, BTN_TOUCH);
+	SETBIT(test_evdev.keybits, BTN_STYLUS);
+	test_evdev_abs(ABS_X, 10208);
+	test_evdev_abs(ABS_Y, 7424);
+	test_evdev_abs(ABS_PRESSURE, 511);
+
+	pInfo = test_usb_tool("stylus");
+	priv = pInfo->private;
+	common = priv->common;
+	channel = &common->wcmChannel[0];
+	priv->tool->enabled = TRUE;
+	/* no smoothing, the history keeps the filtered states */
+	common->wcmRawSample = 1;
+
+	ds.device_type = STYLUS_ID;
+	ds.device_id = STYLUS_DEVICE_ID;
+	ds.proximity = 1;
+	for (i = 1; i <= MAX_SAMPLES + 3; i++)
+	{
+		ds.x = i * 100;
+		ds.y = 1000;
+		wcmSetStateTime(&ds, i * 5000);
+		wcmEvent(common, 0, &ds);
+		assert(wcmChannelState(channel, 0)->x == i * 100);
+	}
+
+	for (i = 0; i < MAX_SAMPLES; i++)
+		assert(wcmChannelState(channel, i)->x == (MAX_SAMPLES + 3 - i) * 100);
+	assert(wcmChannelState(channel, MAX_SAMPLES)->x == 4 * 100);
+	assert(wcmChannelState(channel, 1000)->x == 4 * 100);
+
+	/* suppressed states don't enter the history */
+	wcmEvent(common, 0, &ds);
+	assert(wcmChannelState(channel, 1)->x == (MAX_SAMPLES + 2) * 100);
+
+	test_evdev_close();
+}
+
+static void test_read_budget(void)
+{
+	WacomCommonRec common = {0};
+	int i;
+
+	common.wcmReadBudget = DEFAULT_READ_BUDGET;
+
+	/* running out of budget grows it up to the maximum */
+	for (i = 0; i < 10; i++)
+		wcmAdjustReadBudget(&common, common.wcmReadBudget);
+	assert(common.wcmReadBudget == MAX_READ_BUDGET);
+	assert(common.wcmReadBudgetExhausted == 10);
+
+	/* a busy but keeping-up device leaves it alone */
+	wcmAdjustReadBudget(&common, MAX_READ_BUDGET / 2);
+	assert(common.wcmReadBudget == MAX_READ_BUDGET);
+
+	/* an idle device shrinks it down to the minimum */
+	for (i = 0; i < 10; i++)
+		wcmAdjustReadBudget(&common, 0);
+	assert(common.wcmReadBudget == MIN_READ_BUDGET);
+	wcmAdjustReadBudget(&common, 1);
+	assert(common.wcmReadBudget == MIN_READ_BUDGET);
+	assert(common.wcmReadBudgetExhausted == 10);
+}
+
+static void test_latency_bucket(void)
+{
+	WacomDeviceRec priv = {0};
+	int i;
+
+	assert(wcmLatencyBucket(0) == 0);
+	assert(wcmLatencyBucket(31) == 0);
+	assert(wcmLatencyBucket(32) == 1);
+	assert(wcmLatencyBucket(63) == 1);
+	assert(wcmLatencyBucket(64) == 2);
+	for (i = 1; i < LATENCY_BUCKETS; i++)
+	{
+		uint64_t bound = (uint64_t)1 << (LATENCY_BUCKET_SHIFT + i - 1);
+
+		assert(wcmLatencyBucket(bound - 1) == i - 1);
+		assert(wcmLatencyBucket(bound) == i);
+	}
+	assert(wcmLatencyBucket(~(uint64_t)0) == LATENCY_BUCKETS - 1);
+
+	/* no timestamp, or one from the future, isn't accounted */
+	wcmRecordLatency(&priv, 0);
+	wcmRecordLatency(&priv, wcmTimeUs() + 1000000);
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		assert(priv.latency[i] == 0);
+
+	wcmRecordLatency(&priv, 1);
+	assert(priv.latency[LATENCY_BUCKETS - 1] == 1);
+}
+
+static void test_statistics(void)
+{
+	WacomCommonRec common = {0};
+	WacomDeviceRec priv = {0};
+	uint32_t values[STAT_COUNT];
+	int i;
+
+	priv.common = &common;
+
+	/* every counter lives on exactly one of the two */
+	for (i = 0; i < STAT_COUNT; i++)
+	{
+		common.wcmStats[i] = 1000 + i;
+		priv.stats[i] = 2000 + i;
+	}
+
+	wcmGetStatistics(&priv, values);
+	assert(values[STAT_BYTES_READ] == 1000 + STAT_BYTES_READ);
+	assert(values[STAT_BYTES_READ_HIGH] == 1000 + STAT_BYTES_READ_HIGH);
+	assert(values[STAT_FRAMES] == 1000 + STAT_FRAMES);
+	assert(values[STAT_FRAMES_HIGH] == 1000 + STAT_FRAMES_HIGH);
+	assert(values[STAT_FILTERED] == 1000 + STAT_FILTERED);
+	assert(values[STAT_SUPPRESSED_ALL] == 2000 + STAT_SUPPRESSED_ALL);
+	assert(values[STAT_SUPPRESSED_NON_MOTION] == 2000 + STAT_SUPPRESSED_NON_MOTION);
+	assert(values[STAT_ARBITRATION_LOST] == 2000 + STAT_ARBITRATION_LOST);
+	assert(values[STAT_CHANNEL_EXHAUSTED] == 1000 + STAT_CHANNEL_EXHAUSTED);
+	assert(values[STAT_QUEUE_OVERFLOW] == 1000 + STAT_QUEUE_OVERFLOW);
+	assert(values[STAT_POSTED] == 2000 + STAT_POSTED);
+	assert(values[STAT_POSTED_HIGH] == 2000 + STAT_POSTED_HIGH);
+
+	/* the low word carries into the high word */
+	priv.stats[STAT_POSTED] = UINT32_MAX;
+	wcmStatAdd(priv.stats, STAT_POSTED, 1);
+	assert(priv.stats[STAT_POSTED] == 0);
+	assert(priv.stats[STAT_POSTED_HIGH] == 2000 + STAT_POSTED_HIGH + 1);
+	wcmStatAdd(priv.stats, STAT_POSTED, 1);
+	assert(priv.stats[STAT_POSTED] == 1);
+	assert(priv.stats[STAT_POSTED_HIGH] == 2000 + STAT_POSTED_HIGH + 1);
+}
+
+static void test_trace(void)
+{
+	WacomCommonRec common = {0};
+	WacomTraceRecord ring[TRACE_RING_SIZE];
+	int i;
+
+	/* only the compiled-in categories can be enabled */
+	assert(wcmSetTraceMask(&common, ~0));
+	assert(common.wcmTraceMask == WCM_TRACE_CATEGORIES);
+	assert(!!common.wcmTraceRing == !!WCM_TRACE_CATEGORIES);
+	free(common.wcmTraceRing);
+
+	common.wcmTraceRing = ring;
+	common.wcmTraceMask = TRACE_EVENT;
+
+	TRACE(TRACE_USB, &common, TP_USB_EVENT, 1, 2, 3, 4, 5);
+	assert(common.wcmTraceHead == 0);
+
+	/* the ring wraps, overwriting the oldest records */
+	for (i = 0; i < TRACE_RING_SIZE + 3; i++)
+		wcmTrace(&common, TP_EVENT, i, 0, 0, 0, 0);
+
+	assert(common.wcmTraceHead == TRACE_RING_SIZE + 3);
+	assert(ring[0].args[0] == TRACE_RING_SIZE);
+	assert(ring[2].args[0] == TRACE_RING_SIZE + 2);
+	assert(ring[3].args[0] == 3);
+	assert(ring[3].tracepoint == TP_EVENT);
+	assert(ring[3].time_us != 0);
+}
+
+static void test_flight_recorder(void)
+{
+	WacomCommonPtr common = wcmNewCommon();
+	WacomDeviceState ds = {0};
+	struct wacom_recorder_header header;
+	struct wacom_recorder_record rec;
+	unsigned char raw[100];
+	char dir[] = "/tmp/wacom-tests-XXXXXX";
+	char path[PATH_MAX];
+	glob_t files;
+	FILE *fp;
+	int i;
+
+	assert(common);
+	assert(common->wcmRecorder);
+
+	for (i = 0; i < sizeof(raw); i++)
+		raw[i] = i;
+
+	/* raw data is split into as many records as needed */
+	wcmRecordRaw(common, 1000, raw, sizeof(raw));
+	assert(common->wcmRecorderHead == 2);
+	assert(common->wcmRecorder[1].time_us == 1000);
+
+	/* wrap the ring, the oldest entry may be overwritten while it is
+	 * dumped so only the last RECORDER_SIZE - 1 states survive */
+	for (i = 0; i < RECORDER_SIZE + 10; i++)
+	{
+		ds.x = i;
+		wcmSetStateTime(&ds, 2000 + i);
+		wcmRecordState(common, WACOM_RECORD_FILTER, MAX_CONTACTS + 1, &ds);
+	}
+
+	fp = tmpfile();
+	assert(fp);
+	assert(wcmRecorderWrite(common, fileno(fp)) == RECORDER_SIZE - 1);
+
+	rewind(fp);
+	assert(fread(&header, sizeof(header), 1, fp) == 1);
+	assert(memcmp(header.magic, WACOM_RECORDER_MAGIC, sizeof(header.magic)) == 0);
+	assert(header.version == WACOM_RECORDER_VERSION);
+	assert(header.count == RECORDER_SIZE - 1);
+	assert(header.lost == 13);
+
+	/* oldest first */
+	assert(fread(&rec, sizeof(rec), 1, fp) == 1);
+	assert(rec.seq == 13);
+	assert(rec.kind == WACOM_RECORD_FILTER);
+	assert(rec.channel == MAX_CONTACTS + 1);
+	assert(rec.u.state.x == 11);
+	assert(rec.time_us == 2011);
+
+	fclose(fp);
+
+	/* back to back dumps don't clash on the file name */
+	assert(mkdtemp(dir));
+	common->wcmRecorderDir = strdup(dir);
+	assert(wcmRecorderDump(common) == Success);
+	assert(wcmRecorderDump(common) == Success);
+	snprintf(path, sizeof(path), "%s/*.bin", dir);
+	assert(glob(path, 0, NULL, &files) == 0);
+	assert(files.gl_pathc == 2);
+	for (i = 0; i < files.gl_pathc; i++)
+		unlink(files.gl_pathv[i]);
+	globfree(&files);
+	rmdir(dir);
+
+	wcmFreeCommon(&common);
+}
+
+static void test_deferred_log(void)
+{
+	WacomCommonPtr common = wcmNewCommon();
+	uint64_t now = 5000000;
+	WacomLogSlot *slot;
+
+	assert(common);
+	common->device_path = "/dev/input/event0";
+	slot = &common->wcmLog[LOG_BAD_DATA];
+
+	/* repeats are counted, the first occurrence's arguments kept */
+	wcmLogDeferred(common, LOG_BAD_DATA, 1, 2, 3);
+	wcmLogDeferred(common, LOG_BAD_DATA, 4, 5, 6);
+	assert(slot->pending == 2);
+	assert(slot->args[0] == 1);
+	assert(slot->args[2] == 3);
+
+	assert(wcmLogFlushAt(common, now, FALSE) == 0);
+	assert(slot->pending == 0);
+	assert(slot->last_us == now);
+
+	/* rate limited until LOG_RATE_LIMIT ms after the last line */
+	wcmLogDeferred(common, LOG_BAD_DATA, 7, 8, 9);
+	assert(slot->args[0] == 7);
+	assert(wcmLogFlushAt(common, now + 250000, FALSE) == LOG_RATE_LIMIT - 250);
+	assert(slot->pending == 1);
+	assert(slot->last_us == now);
+
+	assert(wcmLogFlushAt(common, now + LOG_RATE_LIMIT * 1000, FALSE) == 0);
+	assert(slot->pending == 0);
+
+	/* unless forced */
+	wcmLogDeferred(common, LOG_BAD_DATA, 0, 0, 0);
+	assert(wcmLogFlushAt(common, now + LOG_RATE_LIMIT * 1000 + 1, TRUE) == 0);
+	assert(slot->pending == 0);
+
+	common->device_path = NULL;
+	wcmFreeCommon(&common);
+}
+
 static void test_flag_set(void)
 {
 	int i;
@@ -621,14 +1899,34 @@ static void test_flag_set(void)
 int main(int argc, char** argv)
 {
 	test_common_ref();
+	test_alloc_channels();
 	test_rebase_pressure();
 	test_normalize_pressure();
 	test_suppress();
+	test_suppress_axes();
+	test_filter_coord();
+	test_filter_modes();
+	test_predict();
+	test_find_tool();
+	test_init_stages();
 	test_initial_size();
 	test_tilt_to_rotation();
 	test_mod_buttons();
+	test_event_queue_size();
+	test_channel_bits();
 	test_set_type();
 	test_flag_set();
+	test_parse_buffer();
+	test_parse_buffer_frame();
+	test_read_packet();
+	test_resync();
+	test_channel_history();
+	test_read_budget();
+	test_latency_bucket();
+	test_statistics();
+	test_trace();
+	test_flight_recorder();
+	test_deferred_log();
 	test_get_scroll_delta();
 	test_get_wheel_button();
 	return 0;
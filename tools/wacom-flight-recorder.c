@@ -0,0 +1,161 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Decoder for the driver's flight recorder dumps, see xsetwacom's
+ * DumpFlightRecorder */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wacom-recorder.h"
+
+static void usage(void)
+{
+	printf(
+	"Usage: wacom-flight-recorder [options] dump-file\n"
+	"Options:\n"
+	" -h, --help                 - usage\n"
+	" -r, --raw                  - only print raw data records\n"
+	" -s, --states               - only print device state records\n");
+}
+
+static const char *kind_name(int kind)
+{
+	switch (kind)
+	{
+		case WACOM_RECORD_RAW: return "raw";
+		case WACOM_RECORD_PARSE: return "parse";
+		case WACOM_RECORD_FILTER: return "filter";
+		case WACOM_RECORD_POST: return "post";
+	}
+	return "unknown";
+}
+
+static void print_record(const struct wacom_recorder_record *rec,
+			 uint64_t start)
+{
+	uint64_t t = rec->time_us - start;
+	int i;
+
+	printf("%8" PRIu32 " %6" PRIu64 ".%06" PRIu64 " %-6s",
+	       rec->seq, t / 1000000, t % 1000000, kind_name(rec->kind));
+
+	if (rec->kind == WACOM_RECORD_RAW)
+	{
+		for (i = 0; i < rec->len && i < WACOM_RECORDER_RAW_SIZE; i++)
+			printf(" %02x", rec->u.raw[i]);
+	} else
+	{
+		const struct wacom_recorder_state *s = &rec->u.state;
+
+		printf(" c=%d type=%d id=%#x serial=%u prox=%d x=%d y=%d p=%d "
+		       "b=%#x tx=%d ty=%d rot=%d aw=%d aw2=%d rw=%d d=%d th=%d",
+		       rec->channel, s->device_type, s->device_id,
+		       s->serial_num, s->proximity, s->x, s->y, s->pressure,
+		       s->buttons, s->tiltx, s->tilty, s->rotation,
+		       s->abswheel, s->abswheel2, s->relwheel, s->distance,
+		       s->throttle);
+	}
+	printf("\n");
+}
+
+int main (int argc, char **argv)
+{
+	struct wacom_recorder_header header;
+	struct wacom_recorder_record rec;
+	uint64_t start = 0;
+	int raw = 1, states = 1;
+	uint32_t i;
+	FILE *fp;
+
+	int c, optidx = 0;
+	struct option options[] = {
+		{"help", 0, NULL, 'h'},
+		{"raw", 0, NULL, 'r'},
+		{"states", 0, NULL, 's'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "+hrs", options, &optidx)) != -1) {
+		switch(c) {
+			case 'r':
+				states = 0;
+				break;
+			case 's':
+				raw = 0;
+				break;
+			case 'h':
+			default:
+				usage();
+				return 0;
+		}
+	}
+
+	if (optind == argc) {
+		usage();
+		return 0;
+	}
+
+	fp = fopen(argv[optind], "rb");
+	if (!fp) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header.magic, WACOM_RECORDER_MAGIC, sizeof(header.magic)) != 0) {
+		fprintf(stderr, "%s: not a flight recorder dump\n", argv[optind]);
+		fclose(fp);
+		return 1;
+	}
+
+	if (header.version != WACOM_RECORDER_VERSION) {
+		fprintf(stderr, "%s: unsupported version %" PRIu32 "\n",
+			argv[optind], header.version);
+		fclose(fp);
+		return 1;
+	}
+
+	printf("tablet %04x:%04x, %" PRIu32 " records, %" PRIu64 " older records lost\n",
+	       header.vendor_id, header.tablet_id, header.count, header.lost);
+
+	for (i = 0; i < header.count; i++) {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+			fprintf(stderr, "%s: truncated after %" PRIu32 " records\n",
+				argv[optind], i);
+			fclose(fp);
+			return 1;
+		}
+
+		if (i == 0)
+			start = rec.time_us;
+
+		if ((rec.kind == WACOM_RECORD_RAW) ? raw : states)
+			print_record(&rec, start);
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8 shiftwidth=8: */
@@ -108,7 +108,10 @@ static void get_mode(Display *dpy, XDevice *dev, param_t *param, int argc, char
 static void get_map(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
 static void set_rotate(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
 static void get_rotate(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
+static void set_filter_mode(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
+static void get_filter_mode(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
 static void set_xydefault(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
+static void dump_recorder(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
 static void get_all(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
 static void get_param(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
 static void set_output(Display *dpy, XDevice *dev, param_t *param, int argc, char **argv);
@@ -153,6 +156,16 @@ static param_t parameters[] =
 		.prop_offset = 1,
 		.arg_count = 1,
 	},
+	{
+		.name = "TabletTrace",
+		.desc = "Bitmask of the tracepoint categories recorded for the "
+		"tablet: 1 events, 2 USB events, 4 posted events, 8 suppression "
+		"(default is 0 [off]). ",
+		.prop_name = WACOM_PROP_TRACE,
+		.prop_format = 32,
+		.prop_offset = 0,
+		.arg_count = 1,
+	},
 	{
 		.name = "Suppress",
 		.desc = "Number of points trimmed (default is 2). ",
@@ -161,6 +174,16 @@ static param_t parameters[] =
 		.prop_offset = 0,
 		.arg_count = 1,
 	},
+	{
+		.name = "SuppressAxes",
+		.desc = "Suppress thresholds for x, y, touch x, touch y, "
+		"pressure, tilt, rotation, wheels and throttle "
+		"(default is derived from Suppress). ",
+		.prop_name = WACOM_PROP_SAMPLE,
+		.prop_format = 32,
+		.prop_offset = 2,
+		.arg_count = 9,
+	},
 	{
 		.name = "RawSample",
 		.desc = "Number of raw data used to filter the points "
@@ -170,6 +193,24 @@ static param_t parameters[] =
 		.prop_offset = 1,
 		.arg_count = 1,
 	},
+	{
+		.name = "FilterMode",
+		.desc = "Sets the filter used to smooth the points. "
+		"Values = average, oneeuro, kalman (default is average). ",
+		.prop_name = WACOM_PROP_FILTER_MODE,
+		.set_func = set_filter_mode,
+		.get_func = get_filter_mode,
+		.arg_count = 1,
+	},
+	{
+		.name = "Predict",
+		.desc = "Milliseconds ahead of the reported position the pen "
+		"position is extrapolated (default is 0 [off]). ",
+		.prop_name = WACOM_PROP_PREDICT,
+		.prop_format = 32,
+		.prop_offset = 0,
+		.arg_count = 1,
+	},
 	{
 		.name = "PressureCurve",
 		.desc = "Bezier curve for pressure (default is 0 0 100 100 [linear]). ",
@@ -426,6 +467,39 @@ static param_t parameters[] =
 		.arg_count = 1,
 		.prop_flags = PROP_FLAG_READONLY
 	},
+	{
+		.name = "LatencyHistogram",
+		.desc = "Returns the number of events posted with a latency "
+		"below 32us, 64us, ... 524ms and above (16 values). ",
+		.prop_name = WACOM_PROP_LATENCY_HISTOGRAM,
+		.prop_format = 32,
+		.prop_offset = 0,
+		.arg_count = 16,
+		.prop_flags = PROP_FLAG_READONLY
+	},
+	{
+		.name = "Statistics",
+		.desc = "Returns the driver's event counters: bytes read, frames "
+		"(low and high 32 bits each), filtered, suppressed, suppressed "
+		"to motion, arbitration lost, channels exhausted, queue "
+		"overflows, posted (low and high 32 bits) (12 values). ",
+		.prop_name = WACOM_PROP_STATISTICS,
+		.prop_format = 32,
+		.prop_offset = 0,
+		.arg_count = 12,
+		.prop_flags = PROP_FLAG_READONLY
+	},
+	{
+		.name = "DumpFlightRecorder",
+		.desc = "Writes the tablet's recent raw data and device states "
+		"to a file in the driver's FlightRecorderDir. ",
+		.prop_name = WACOM_PROP_FLIGHT_RECORDER,
+		.prop_format = 8,
+		.prop_offset = 0,
+		.arg_count = 0,
+		.prop_flags = PROP_FLAG_WRITEONLY,
+		.set_func = dump_recorder,
+	},
 	{
 		.name = "BindToSerial",
 		.desc = "Binds this device to the serial number.",
@@ -1486,6 +1560,31 @@ out:
 	free(data);
 }
 
+static void dump_recorder(Display *dpy, XDevice *dev, param_t* param, int argc, char **argv)
+{
+	Atom prop;
+	unsigned char dump = 1;
+
+	if (argc != param->arg_count)
+	{
+		fprintf(stderr, "'%s' requires exactly %d value(s).\n", param->name,
+			param->arg_count);
+		return;
+	}
+
+	prop = XInternAtom(dpy, param->prop_name, True);
+	if (!prop)
+	{
+		fprintf(stderr, "Property for '%s' not available.\n",
+			param->name);
+		return;
+	}
+
+	XChangeDeviceProperty(dpy, dev, prop, XA_INTEGER, 8,
+				PropModeReplace, &dump, 1);
+	XFlush(dpy);
+}
+
 static void set_mode(Display *dpy, XDevice *dev, param_t* param, int argc, char **argv)
 {
 	int mode = Absolute;
@@ -1573,6 +1672,65 @@ static void set_rotate(Display *dpy, XDevice *dev, param_t* param, int argc, cha
 }
 
 
+static const char *filter_modes[] = { "average", "oneeuro", "kalman" };
+
+static void set_filter_mode(Display *dpy, XDevice *dev, param_t* param, int argc, char **argv)
+{
+	int mode;
+	Atom prop, type;
+	int format;
+	unsigned char* data;
+	unsigned long nitems, bytes_after;
+
+	if (argc != param->arg_count)
+	{
+		fprintf(stderr, "'%s' requires exactly %d value(s).\n", param->name,
+			param->arg_count);
+		return;
+	}
+
+	TRACE("Filter mode '%s' for device %ld.\n", argv[0], dev->device_id);
+
+	for (mode = 0; mode < ARRAY_SIZE(filter_modes); mode++)
+	{
+		char num[2] = { '0' + mode, '\0' };
+
+		if (strcasecmp(argv[0], filter_modes[mode]) == 0 ||
+		    strcmp(argv[0], num) == 0)
+			break;
+	}
+
+	if (mode == ARRAY_SIZE(filter_modes))
+	{
+		fprintf(stderr, "'%s' is not a valid value for the '%s' property.\n",
+		        argv[0], param->name);
+		return;
+	}
+
+	prop = XInternAtom(dpy, param->prop_name, True);
+	if (!prop)
+	{
+		fprintf(stderr, "Property for '%s' not available.\n",
+			param->name);
+		return;
+	}
+
+	XGetDeviceProperty(dpy, dev, prop, 0, 1000, False, AnyPropertyType,
+				&type, &format, &nitems, &bytes_after, &data);
+
+	if (nitems == 0 || format != 8)
+	{
+		fprintf(stderr, "Property for '%s' has no or wrong value - this is a bug.\n",
+			param->name);
+		return;
+	}
+
+	*data = mode;
+	XChangeDeviceProperty(dpy, dev, prop, type, format,
+				PropModeReplace, data, nitems);
+	XFlush(dpy);
+}
+
 /**
  * Performs intelligent string->int conversion. In addition to converting strings
  * of digits into their corresponding integer values, it converts special string
@@ -1839,6 +1997,42 @@ static void get_rotate(Display *dpy, XDevice *dev, param_t* param, int argc, cha
 	return;
 }
 
+static void get_filter_mode(Display *dpy, XDevice *dev, param_t* param, int argc, char **argv)
+{
+	Atom prop, type;
+	int format;
+	unsigned char* data;
+	unsigned long nitems, bytes_after;
+
+	if (argc != 0)
+	{
+		fprintf(stderr, "Incorrect number of arguments supplied.\n");
+		return;
+	}
+
+	prop = XInternAtom(dpy, param->prop_name, True);
+	if (!prop)
+	{
+		fprintf(stderr, "Property for '%s' not available.\n",
+			param->name);
+		return;
+	}
+
+	TRACE("Getting filter mode for device %ld.\n", dev->device_id);
+
+	XGetDeviceProperty(dpy, dev, prop, 0, 1000, False, AnyPropertyType,
+				&type, &format, &nitems, &bytes_after, &data);
+
+	if (nitems == 0 || format != 8 || *data >= ARRAY_SIZE(filter_modes))
+	{
+		fprintf(stderr, "Property for '%s' has no or wrong value - this is a bug.\n",
+			param->name);
+		return;
+	}
+
+	print_value(param, "%s", filter_modes[*data]);
+}
+
 /**
  * Try to print the value of the action mapped to the given parameter's
  * property. If the property contains data in the wrong format/type then
@@ -2534,7 +2728,7 @@ static void get_param(Display *dpy, XDevice *dev, param_t *param, int argc, char
 	unsigned char* data;
 	unsigned long nitems, bytes_after;
 	int i;
-	char str[100] = {0};
+	char str[200] = {0};
 
 	if (param->prop_name)
 	{
@@ -2805,7 +2999,7 @@ static void test_parameter_number(void)
 	 * deprecated them.
 	 * Numbers include trailing NULL entry.
 	 */
-	assert(ARRAY_SIZE(parameters) == 39);
+	assert(ARRAY_SIZE(parameters) == 45);
 	assert(ARRAY_SIZE(deprecated_parameters) == 17);
 }
 